@@ -7,7 +7,12 @@
 //
 
 #include <iostream>
+#include <numeric>
+#include <thread>
 #include <BasicSOFA.hpp>
+#include <SOFAPrefetcher.hpp>
+#include <SOFAHRIRCache.hpp>
+#include <SOFACatalog.hpp>
 
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
@@ -73,6 +78,483 @@ TEST_CASE("Valid SOFA File Test", "[Valid SOFA Test]")
         REQUIRE(outFile.is_open() == false);
     }
     
+    SECTION("Interleaved Padded Layout Check")
+    {
+        BasicSOFA::BasicSOFA interleavedSofa;
+        interleavedSofa.setIRLayout(BasicSOFA::SOFAIRLayout::Interleaved, true);
+        REQUIRE(interleavedSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        
+        auto layout = interleavedSofa.getLayoutDescriptor();
+        REQUIRE(layout.layout == BasicSOFA::SOFAIRLayout::Interleaved);
+        REQUIRE(layout.length == 512);
+        REQUIRE(layout.paddedLength % (SOFA_IR_ALIGNMENT / sizeof(double)) == 0);
+        REQUIRE(layout.sampleStride == 2);
+        REQUIRE(layout.measurementStride == 2 * layout.paddedLength);
+        REQUIRE(interleavedSofa.getMinImpulseDelay() == sofa.getMinImpulseDelay());
+        
+        const double *block = interleavedSofa.getHRIRBlock(0, 90, 1);
+        REQUIRE(block != nullptr);
+        REQUIRE(layout.alignment == SOFA_IR_ALIGNMENT);
+        REQUIRE(reinterpret_cast<uintptr_t>(block) % SOFA_IR_ALIGNMENT == 0);
+        
+        //  Without padding, the reported alignment must hold for every IR, not only the first
+        auto unpaddedAlignment = sofa.getLayoutDescriptor().alignment;
+        REQUIRE(unpaddedAlignment >= sizeof(double));
+        REQUIRE(unpaddedAlignment <= SOFA_IR_ALIGNMENT);
+        
+        for (auto channel = 0; channel < 2; ++channel)
+            REQUIRE(reinterpret_cast<uintptr_t>(sofa.getHRIR(channel, 10, 0, 1)) % unpaddedAlignment == 0);
+        
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            const double *interleavedIR = interleavedSofa.getHRIR(channel, 0, 90, 1);
+            REQUIRE(interleavedIR == block + (channel * layout.receiverStride));
+            
+            for (auto i = 0; i < sofa.getN(); ++i)
+                REQUIRE(interleavedIR[i * layout.sampleStride] == ir[i]);
+        }
+    }
+    
+    SECTION("Direct Chunk Read Check")
+    {
+        BasicSOFA::BasicSOFA directSofa;
+        directSofa.setDirectChunkRead(true);
+        REQUIRE(directSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        
+        //  The test set is deflate compressed, so the HDF5 fallback must not have been taken
+        REQUIRE(directSofa.isDirectChunkReadUsed() == true);
+        REQUIRE(sofa.isDirectChunkReadUsed() == false);
+        REQUIRE(directSofa.getMinImpulseDelay() == sofa.getMinImpulseDelay());
+        
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            const double *directIR = directSofa.getHRIR(channel, 0, 90, 1);
+            REQUIRE(directIR != nullptr);
+            
+            for (auto i = 0; i < sofa.getN(); ++i)
+                REQUIRE(directIR[i] == ir[i]);
+        }
+    }
+    
+    SECTION("Trajectory Prefetch Check")
+    {
+        BasicSOFA::SOFAPrefetcher prefetcher(sofa, 1, 4);
+        REQUIRE(prefetcher.start() == true);
+        
+        std::vector<BasicSOFA::SOFATrajectoryPoint> trajectory;
+        for (uint64_t block = 0; block < 8; ++block)
+            trajectory.push_back({block, 10.0 * block, 0, 1});
+        
+        REQUIRE(prefetcher.setTrajectory(0, trajectory) == true);
+        
+        for (uint64_t block = 0; block < 8; ++block)
+        {
+            const BasicSOFA::SOFAPrefetchedHRIR *entry = nullptr;
+            for (auto attempt = 0; attempt < 1000 && entry == nullptr; ++attempt)
+            {
+                entry = prefetcher.getPrefetchedHRIR(0, block);
+                if (entry == nullptr)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            
+            REQUIRE(entry != nullptr);
+            REQUIRE(entry->valid == true);
+            
+            for (auto channel = 0; channel < 2; ++channel)
+            {
+                const double *ir = sofa.getHRIR(channel, 10.0 * block, 0, 1);
+                REQUIRE(ir != nullptr);
+                
+                for (auto i = 0; i < sofa.getN(); ++i)
+                    REQUIRE(entry->getHRIR(channel)[i] == ir[i]);
+            }
+        }
+        
+        prefetcher.stop();
+        
+        //  A prefetcher built before the data is loaded cannot start until the load
+        BasicSOFA::BasicSOFA lateSofa;
+        BasicSOFA::SOFAPrefetcher earlyPrefetcher(lateSofa, 1, 4);
+        REQUIRE(earlyPrefetcher.start() == false);
+        REQUIRE(lateSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(earlyPrefetcher.start() == true);
+        REQUIRE(earlyPrefetcher.setTrajectory(0, {{0, 0, 90, 1}}) == true);
+        
+        const BasicSOFA::SOFAPrefetchedHRIR *entry = nullptr;
+        for (auto attempt = 0; attempt < 1000 && entry == nullptr; ++attempt)
+        {
+            entry = earlyPrefetcher.getPrefetchedHRIR(0, 0);
+            if (entry == nullptr)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        
+        REQUIRE(entry != nullptr);
+        REQUIRE(entry->valid == true);
+        REQUIRE(entry->N == sofa.getN());
+        
+        for (auto i = 0; i < sofa.getN(); ++i)
+            REQUIRE(entry->getHRIR(1)[i] == sofa.getHRIR(1, 0, 90, 1)[i]);
+        
+        earlyPrefetcher.stop();
+    }
+    
+    SECTION("HRIR Cache Check")
+    {
+        BasicSOFA::SOFAHRIRCache cache(sofa, 4);
+        std::vector<double> cachedIR(sofa.getN());
+        
+        for (auto pass = 0; pass < 2; ++pass)
+        {
+            for (auto channel = 0; channel < 2; ++channel)
+            {
+                REQUIRE(cache.getHRIR(channel, 0.02, 90, 1, cachedIR.data()) == true);
+                
+                const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+                for (auto i = 0; i < sofa.getN(); ++i)
+                    REQUIRE(cachedIR[i] == ir[i]);
+            }
+        }
+        
+        auto statistics = cache.getStatistics();
+        REQUIRE(statistics.misses == 2);
+        REQUIRE(statistics.hits == 2);
+        REQUIRE(statistics.getHitRate() == 0.5);
+        
+        REQUIRE(cache.getHRIR(0, 0, 90, 100, cachedIR.data()) == false);
+        
+        //  A cache built before the data is loaded sizes its slots on the first query after the load
+        BasicSOFA::BasicSOFA lateSofa;
+        BasicSOFA::SOFAHRIRCache earlyCache(lateSofa, 4);
+        REQUIRE(earlyCache.getHRIR(0, 0, 90, 1, cachedIR.data()) == false);
+        REQUIRE(lateSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        
+        for (auto pass = 0; pass < 2; ++pass)
+        {
+            REQUIRE(earlyCache.getHRIR(0, 0, 90, 1, cachedIR.data()) == true);
+            
+            const double *ir = sofa.getHRIR(0, 0, 90, 1);
+            for (auto i = 0; i < sofa.getN(); ++i)
+                REQUIRE(cachedIR[i] == ir[i]);
+        }
+    }
+    
+    SECTION("Distance Model Check")
+    {
+        BasicSOFA::BasicSOFA modelSofa;
+        modelSofa.setDistanceModel(true, 1);
+        REQUIRE(modelSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        
+        REQUIRE(modelSofa.isDistanceModelEnabled() == true);
+        REQUIRE(modelSofa.getReferenceRadius() == 1);
+        REQUIRE(modelSofa.getMinRadius() == 1);
+        REQUIRE(modelSofa.getMaxRadius() == 1);
+        REQUIRE(modelSofa.getM() < sofa.getM());
+        REQUIRE(modelSofa.getHRIR(0, 0, 90, 0.5) == nullptr);
+        
+        std::vector<double> modelledIR(modelSofa.getN());
+        
+        //  At the reference radius the correction filter is (almost) an identity
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            REQUIRE(modelSofa.getDistanceModelledHRIR(channel, 0, 90, 1, modelledIR.data()) == true);
+            
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            for (auto i = 0; i < sofa.getN(); ++i)
+                REQUIRE(modelledIR[i] == Approx(ir[i]).margin(1e-3));
+        }
+        
+        //  Moving a source on the left closer should raise the level difference between the ears
+        double leftEnergy[2] = {0, 0};
+        double rightEnergy[2] = {0, 0};
+        const double distances[2] = {1, 0.25};
+        
+        for (auto d = 0; d < 2; ++d)
+        {
+            REQUIRE(modelSofa.getDistanceModelledHRIR(0, 90, 0, distances[d], modelledIR.data(), false) == true);
+            for (auto sample : modelledIR)
+                leftEnergy[d] += sample * sample;
+            
+            REQUIRE(modelSofa.getDistanceModelledHRIR(1, 90, 0, distances[d], modelledIR.data(), false) == true);
+            for (auto sample : modelledIR)
+                rightEnergy[d] += sample * sample;
+        }
+        
+        REQUIRE(leftEnergy[1] / rightEnergy[1] > leftEnergy[0] / rightEnergy[0]);
+        REQUIRE(modelSofa.getDistanceModelledHRIR(0, 90, 0, 0.05, modelledIR.data()) == false);
+        
+        //  Reloading with the model switched off then on again must not keep anything from the previous load
+        auto referenceM = modelSofa.getM();
+        modelSofa.setDistanceModel(false);
+        REQUIRE(modelSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(modelSofa.getM() == sofa.getM());
+        REQUIRE(modelSofa.getReferenceRadius() == 0);
+        
+        for (auto radius : {0.5, 1.0})
+        {
+            const double *ir = sofa.getHRIR(0, 0, 90, radius);
+            const double *reloadedIR = modelSofa.getHRIR(0, 0, 90, radius);
+            REQUIRE(reloadedIR != nullptr);
+            
+            for (auto i = 0; i < sofa.getN(); ++i)
+                REQUIRE(reloadedIR[i] == ir[i]);
+        }
+        
+        modelSofa.setDistanceModel(true, 1);
+        REQUIRE(modelSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(modelSofa.getM() == referenceM);
+        REQUIRE(modelSofa.getHRIR(0, 0, 90, 0.5) == nullptr);
+    }
+    
+    SECTION("Sample Rate Conversion Check")
+    {
+        BasicSOFA::BasicSOFA resampledSofa;
+        resampledSofa.setTargetSampleRate(44100);
+        REQUIRE(resampledSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        
+        REQUIRE(resampledSofa.getFs() == 44100);
+        REQUIRE(resampledSofa.getN() == 471);
+        REQUIRE(resampledSofa.getM() == sofa.getM());
+        
+        //  Energy is preserved as long as the IR has little content above the new Nyquist frequency
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            const double *resampledIR = resampledSofa.getHRIR(channel, 0, 90, 1);
+            REQUIRE(resampledIR != nullptr);
+            
+            double energy = 0;
+            double resampledEnergy = 0;
+            
+            for (auto i = 0; i < sofa.getN(); ++i)
+                energy += ir[i] * ir[i] / sofa.getFs();
+            
+            for (auto i = 0; i < resampledSofa.getN(); ++i)
+                resampledEnergy += resampledIR[i] * resampledIR[i] / resampledSofa.getFs();
+            
+            REQUIRE(resampledEnergy == Approx(energy).epsilon(0.05));
+        }
+    }
+    
+    SECTION("Catalog Budget Check")
+    {
+        //  Room for two copies of the dataset
+        BasicSOFA::SOFACatalog catalog(2 * sofa.getMemoryUsage() + 1);
+        
+        REQUIRE(catalog.addDataset("listener0", VALID_SOFA_FILEPATH) == true);
+        REQUIRE(catalog.addDataset("listener1", VALID_SOFA_FILEPATH) == true);
+        REQUIRE(catalog.addDataset("listener2", VALID_SOFA_FILEPATH) == true);
+        REQUIRE(catalog.addDataset("listener0", VALID_SOFA_FILEPATH) == false);
+        
+        REQUIRE(catalog.pin("listener0") == true);
+        REQUIRE(catalog.acquire("listener1") != nullptr);
+        
+        auto dataset = catalog.acquire("listener2");
+        REQUIRE(dataset != nullptr);
+        REQUIRE(dataset->getHRIR(0, 0, 90, 1) != nullptr);
+        REQUIRE(catalog.getMemoryUsage() <= catalog.getMemoryBudget());
+        
+        //  listener1 is the least recently used unpinned dataset so it is the one evicted
+        for (const auto &residency : catalog.getResidency())
+        {
+            if (residency.id == "listener0")
+                REQUIRE((residency.loaded == true && residency.pinCount == 1));
+            if (residency.id == "listener1")
+                REQUIRE((residency.loaded == false && residency.bytes == 0));
+            if (residency.id == "listener2")
+                REQUIRE(residency.loaded == true);
+        }
+        
+        REQUIRE(catalog.acquire("unknown") == nullptr);
+        
+        //  An evicted dataset still held by a caller keeps counting against the budget and is handed out again on the next acquire
+        catalog.setMemoryBudget(0);
+        REQUIRE(catalog.getMemoryUsage() == 2 * dataset->getMemoryUsage());
+        
+        for (const auto &residency : catalog.getResidency())
+        {
+            if (residency.id == "listener2")
+                REQUIRE((residency.loaded == false && residency.heldAfterEviction == true && residency.bytes > 0));
+        }
+        
+        REQUIRE(catalog.acquire("listener2") == dataset);
+        
+        //  Concurrent acquires of a dataset that is not loaded share a single load
+        catalog.setMemoryBudget(4 * sofa.getMemoryUsage());
+        std::shared_ptr<const BasicSOFA::BasicSOFA> first;
+        std::shared_ptr<const BasicSOFA::BasicSOFA> second;
+        
+        std::thread loader([&]() { first = catalog.acquire("listener1"); });
+        second = catalog.acquire("listener1");
+        loader.join();
+        
+        REQUIRE(first != nullptr);
+        REQUIRE(first == second);
+    }
+    
+    SECTION("Reduced Precision Storage Check")
+    {
+        for (auto format : {BasicSOFA::SOFASampleFormat::Int16, BasicSOFA::SOFASampleFormat::Float16})
+        {
+            BasicSOFA::BasicSOFA compressedSofa;
+            compressedSofa.setSampleFormat(format);
+            REQUIRE(compressedSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+            REQUIRE(compressedSofa.getSampleFormat() == format);
+            REQUIRE(compressedSofa.getHRIR(0, 0, 90, 1) == nullptr);
+            REQUIRE(compressedSofa.getMemoryUsage() < sofa.getMemoryUsage() / 2);
+            
+            //  Worst case error relative to the IR peak, see setSampleFormat()
+            auto tolerance = format == BasicSOFA::SOFASampleFormat::Int16 ? 1.0 / 65534.0 : 1.0 / 2048.0;
+            std::vector<double> decodedIR(compressedSofa.getN());
+            
+            for (auto channel = 0; channel < 2; ++channel)
+            {
+                const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+                REQUIRE(compressedSofa.copyHRIR(channel, 0, 90, 1, decodedIR.data()) == true);
+                
+                double peak = 0.0;
+                for (auto i = 0; i < sofa.getN(); ++i)
+                    peak = std::max(peak, fabs(ir[i]));
+                
+                for (auto i = 0; i < sofa.getN(); ++i)
+                    REQUIRE(fabs(decodedIR[i] - ir[i]) <= peak * tolerance);
+            }
+        }
+        
+        //  16 bit IRs are always stored contiguously
+        BasicSOFA::BasicSOFA interleavedSofa;
+        interleavedSofa.setSampleFormat(BasicSOFA::SOFASampleFormat::Int16);
+        interleavedSofa.setIRLayout(BasicSOFA::SOFAIRLayout::Interleaved);
+        REQUIRE(interleavedSofa.readSOFAFile(VALID_SOFA_FILEPATH) == false);
+        
+        //  Padded 16 bit IRs keep every IR on a SOFA_IR_ALIGNMENT boundary
+        BasicSOFA::BasicSOFA paddedSofa;
+        paddedSofa.setSampleFormat(BasicSOFA::SOFASampleFormat::Int16);
+        paddedSofa.setIRLayout(BasicSOFA::SOFAIRLayout::Contiguous, true);
+        REQUIRE(paddedSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        
+        auto layout = paddedSofa.getLayoutDescriptor();
+        REQUIRE(layout.paddedLength % (SOFA_IR_ALIGNMENT / sizeof(uint16_t)) == 0);
+        REQUIRE(layout.alignment == SOFA_IR_ALIGNMENT);
+        
+        std::vector<double> paddedIR(sofa.getN());
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            REQUIRE(paddedSofa.copyHRIR(channel, 0, 90, 1, paddedIR.data()) == true);
+            
+            double peak = 0.0;
+            for (auto i = 0; i < sofa.getN(); ++i)
+                peak = std::max(peak, fabs(ir[i]));
+            
+            for (auto i = 0; i < sofa.getN(); ++i)
+                REQUIRE(fabs(paddedIR[i] - ir[i]) <= peak / 65534.0);
+        }
+    }
+    
+    SECTION("Ambisonic Decoder Check")
+    {
+        BasicSOFA::BasicSOFA ambisonicSofa;
+        ambisonicSofa.setAmbisonicDecoder(true, 3, 1, true);
+        REQUIRE(ambisonicSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(ambisonicSofa.getNumAmbisonicChannels() == 16);
+        REQUIRE(ambisonicSofa.getAmbisonicFilterLength() >= sofa.getN());
+        REQUIRE(ambisonicSofa.getAmbisonicFilter(0, 16) == nullptr);
+        REQUIRE(ambisonicSofa.getMemoryUsage() > sofa.getMemoryUsage());
+        
+        auto length = ambisonicSofa.getAmbisonicFilterLength();
+        std::vector<double> coefficients(16);
+        BasicSOFA::BasicSOFA::getAmbisonicCoefficients(3, 0, 90, coefficients.data());
+        
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            //  The spectrum at DC is the sum of the filter taps
+            const double *filter = ambisonicSofa.getAmbisonicFilter(channel, 0);
+            const std::complex<double> *spectrum = ambisonicSofa.getAmbisonicSpectrum(channel, 0);
+            REQUIRE(spectrum != nullptr);
+            REQUIRE(spectrum[0].real() == Approx(std::accumulate(filter, filter + length, 0.0)).margin(1e-9));
+            
+            //  Decoding a plane wave from a measured direction should keep the energy of the measured IR
+            std::vector<double> decodedIR(length, 0.0);
+            for (auto acn = 0; acn < 16; ++acn)
+            {
+                filter = ambisonicSofa.getAmbisonicFilter(channel, acn);
+                for (auto i = 0; i < length; ++i)
+                    decodedIR[i] += coefficients[acn] * filter[i];
+            }
+            
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            double energy = 0.0;
+            double decodedEnergy = 0.0;
+            
+            for (auto i = 0; i < sofa.getN(); ++i)
+                energy += ir[i] * ir[i];
+            
+            for (auto i = 0; i < length; ++i)
+                decodedEnergy += decodedIR[i] * decodedIR[i];
+            
+            REQUIRE(fabs(10.0 * log10(decodedEnergy / energy)) < 3.0);
+        }
+        
+        //  Reloading without the decoder must drop the filters built by the previous load
+        ambisonicSofa.setAmbisonicDecoder(false);
+        REQUIRE(ambisonicSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(ambisonicSofa.getNumAmbisonicChannels() == 0);
+        REQUIRE(ambisonicSofa.getAmbisonicFilterLength() == 0);
+        REQUIRE(ambisonicSofa.getAmbisonicFilter(0, 0) == nullptr);
+        REQUIRE(ambisonicSofa.getAmbisonicSpectrum(0, 0) == nullptr);
+        REQUIRE(ambisonicSofa.getMemoryUsage() == sofa.getMemoryUsage());
+    }
+    
+    SECTION("Level of Detail Check")
+    {
+        BasicSOFA::BasicSOFA lodSofa;
+        lodSofa.setLevelOfDetail(true, {32, 64});
+        REQUIRE(lodSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(lodSofa.getShortHRIRLengths() == std::vector<size_t>({32, 64}));
+        
+        BasicSOFA::SOFAParametricHRIR parameters;
+        REQUIRE(lodSofa.getParametricHRIR(0, 90, 1, parameters) == true);
+        REQUIRE(fabs(parameters.itd) <= 0.001);
+        REQUIRE(parameters.gain > 0.0);
+        
+        //  A source on the left reaches the left ear first and louder
+        REQUIRE(lodSofa.getParametricHRIR(90, 0, 1, parameters) == true);
+        REQUIRE(parameters.itd > 0.0);
+        REQUIRE(parameters.ild > 0.0);
+        
+        REQUIRE(lodSofa.getParametricHRIR(-90, 0, 1, parameters) == true);
+        REQUIRE(parameters.itd < 0.0);
+        REQUIRE(parameters.ild < 0.0);
+        REQUIRE(lodSofa.getParametricHRIR(0, 90, 1000, parameters) == false);
+        
+        size_t delay;
+        REQUIRE(lodSofa.getShortHRIR(0, 0, 90, 1, 48, delay) == nullptr);
+        
+        for (auto channel = 0; channel < 2; ++channel)
+        {
+            const double *ir = sofa.getHRIR(channel, 0, 90, 1);
+            
+            for (size_t length : {32, 64})
+            {
+                const double *shortIR = lodSofa.getShortHRIR(channel, 0, 90, 1, length, delay);
+                REQUIRE(shortIR != nullptr);
+                REQUIRE(delay + length <= sofa.getN());
+                
+                for (auto i = 0; i < length; ++i)
+                    REQUIRE(shortIR[i] == ir[delay + i]);
+            }
+        }
+        
+        //  Reloading without level of detail must drop the tables built by the previous load
+        lodSofa.setLevelOfDetail(false);
+        REQUIRE(lodSofa.readSOFAFile(VALID_SOFA_FILEPATH) == true);
+        REQUIRE(lodSofa.getShortHRIRLengths().empty());
+        REQUIRE(lodSofa.getParametricHRIR(90, 0, 1, parameters) == false);
+        REQUIRE(lodSofa.getShortHRIR(0, 0, 90, 1, 32, delay) == nullptr);
+    }
+    
     SECTION("BasicSOFA Object Reset")
     {
         sofa.resetSOFAData();
@@ -7,6 +7,21 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cmath>
+#include <numeric>
+#include <functional>
+#include <zlib.h>
+
+//  The 16 bit decode kernels are compiled for AVX2/F16C whatever the build flags and picked at run time
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SOFA_X86_DECODE_KERNELS
+#include <immintrin.h>
+#endif
 #include "BasicSOFA.hpp"
 #include "BasicSOFAPriv.hpp"
 
@@ -38,6 +53,38 @@ namespace BasicSOFA
         N = 0;
         C = 0;
         R = 0;
+        
+        irLayout = SOFAIRLayout::Contiguous;
+        padIRs = false;
+        requestedLayout = SOFAIRLayout::Contiguous;
+        requestedPadding = false;
+        sampleFormat = SOFASampleFormat::Double;
+        requestedFormat = SOFASampleFormat::Double;
+        paddedN = 0;
+        directChunkRead = false;
+        directChunkReadUsed = false;
+        loaderThreads = 0;
+        
+        targetFs = 0;
+        resamplerThreads = 0;
+        
+        distanceModelEnabled = false;
+        requestedReferenceRadius = 0;
+        referenceRadius = 0;
+        headRadius = 0.0875;
+        
+        ambisonicDecoderEnabled = false;
+        requestedAmbisonicOrder = 1;
+        ambisonicRadius = 0;
+        ambisonicSpectraEnabled = false;
+        magLSCutoff = 0;
+        ambisonicThreads = 0;
+        ambisonicOrder = 0;
+        ambisonicLength = 0;
+        
+        lodEnabled = false;
+        
+        dataLoaded = false;
     }
     
     
@@ -46,6 +93,16 @@ namespace BasicSOFA
         if (filePath == "")
             return false;
         
+        //  16 bit IRs are always stored contiguously, see encodeHRIRData()
+        if (requestedFormat != SOFASampleFormat::Double && requestedLayout == SOFAIRLayout::Interleaved)
+        {
+            std::cout << "Interleaved IR layout is not supported with 16 bit sample formats" << std::endl;
+            return false;
+        }
+        
+        //  Nothing from a previous load (eg. with other load options) may survive into this one
+        resetSOFAData();
+        
         try
         {
             h5File = H5::H5File(filePath, H5F_ACC_RDONLY);
@@ -128,11 +185,6 @@ namespace BasicSOFA
                 return false;
             }
             
-            std::cout << "Reading HRIR data..." << std::endl;
-            hrir = std::vector<double>(M * N * R);
-            dataSet.read(hrir.data(), H5::PredType::NATIVE_DOUBLE);
-            
-            
             //  Map coordinates to impulse responses
             std::vector<double> coordinates = getCoordinatesFromSOFAFile();
             if (coordinates.size() == 0)
@@ -150,6 +202,14 @@ namespace BasicSOFA
                 return false;
             }
             
+            //  With the distance model, only the IRs measured at the reference radius are loaded
+            if (distanceModelEnabled && !selectReferenceRadius(coordinates))
+            {
+                std::cout << "Reference radius not found in SOFA file" << std::endl;
+                resetSOFAData();
+                return false;
+            }
+            
             bool success = buildCoordinateMap(coordinates);
             if (!success)
             {
@@ -159,6 +219,26 @@ namespace BasicSOFA
             }
             
             
+            std::cout << "Reading HRIR data..." << std::endl;
+            if (!readHRIRData(dataSet))
+            {
+                std::cout << "Error reading HRIR data" << std::endl;
+                resetSOFAData();
+                return false;
+            }
+            
+            if (targetFs > 0 && targetFs != fs)
+            {
+                std::cout << "Resampling HRIR data..." << std::endl;
+                if (!resampleHRIRData())
+                {
+                    std::cout << "Unsupported sample rate conversion" << std::endl;
+                    resetSOFAData();
+                    return false;
+                }
+            }
+            
+            
             //  Get statistical data on the coordinates
             success = calculateCoordinateStatisticalData();
             if (!success)
@@ -177,6 +257,27 @@ namespace BasicSOFA
                 return false;
             }
             
+            
+            if (distanceModelEnabled)
+                buildNearFieldFilterBank();
+            
+            if (ambisonicDecoderEnabled)
+            {
+                std::cout << "Building Ambisonic decoder..." << std::endl;
+                if (!buildAmbisonicDecoder())
+                {
+                    std::cout << "Could not build Ambisonic decoder" << std::endl;
+                    resetSOFAData();
+                    return false;
+                }
+            }
+            
+            if (lodEnabled)
+                buildLevelOfDetailTiers();
+            
+            if (requestedFormat != SOFASampleFormat::Double)
+                encodeHRIRData();
+            
         }
         catch (H5::FileIException error)
         {
@@ -209,27 +310,458 @@ namespace BasicSOFA
         if (!dataLoaded)
             return nullptr;
         
-        if (channel >= R)
+        if (channel >= R || sampleFormat != SOFASampleFormat::Double)
             return nullptr;
         
-        auto radiusIt = radiusMap.find(round(radius));
-        if (radiusIt == radiusMap.end())
+        size_t irIndex;
+        if (!findIRIndex(theta, phi, radius, irIndex))
             return nullptr;
         
-        auto map = coordinateMaps.at(radiusIt->second);
+        return hrir.data() + getIROffset(irIndex, channel);
+    }
+    
+    
+    /*
+     *  Return the start of the block holding the IRs of every receiver for a given direction
+     *  How the receivers are arranged within the block is described by getLayoutDescriptor()
+     *  With the interleaved layout, this is one contiguous run of R x paddedLength samples
+     *  Returns nullptr when the IRs are stored in a 16 bit sample format, see setSampleFormat()
+     */
+    const double* BasicSOFA::getHRIRBlock(double theta, double phi, double radius) const noexcept
+    {
+        if (!dataLoaded || sampleFormat != SOFASampleFormat::Double)
+            return nullptr;
         
-        auto phiIt = map.phiMap.find(round(phi));
-        if (phiIt == map.phiMap.end())
+        size_t irIndex;
+        if (!findIRIndex(theta, phi, radius, irIndex))
             return nullptr;
         
-        auto thetaMap = map.thetaMaps.at(phiIt->second);
-        auto thetaIt = thetaMap.find(round(theta));
-        if (thetaIt == thetaMap.end())
+        return hrir.data() + getIROffset(irIndex, 0);
+    }
+    
+    
+    /*
+     *  Copy the N samples of an IR into dest, which must hold at least getN() samples
+     *  Unlike getHRIR(), the copy is always contiguous regardless of the selected layout
+     *  and it works with every sample format, decoding 16 bit IRs on the fly
+     */
+    bool BasicSOFA::copyHRIR(size_t channel, double theta, double phi, double radius, double *dest) const noexcept
+    {
+        if (!dataLoaded || channel >= R || dest == nullptr)
+            return false;
+        
+        size_t irIndex;
+        if (!findIRIndex(theta, phi, radius, irIndex))
+            return false;
+        
+        return decodeHRIR(irIndex, channel, dest);
+    }
+    
+    
+    /*
+     *  Select the memory layout used for the IRs
+     *  This takes effect on the next call to readSOFAFile()
+     *  If padToSIMDWidth is set, every IR is zero padded to a multiple of SOFA_IR_ALIGNMENT bytes
+     */
+    void BasicSOFA::setIRLayout(SOFAIRLayout layout, bool padToSIMDWidth)
+    {
+        requestedLayout = layout;
+        requestedPadding = padToSIMDWidth;
+    }
+    
+    
+    /*
+     *  Read compressed HRIR data chunk by chunk, bypassing the HDF5 filter pipeline and datatype conversion
+     *  Chunks are read raw from the file and then decompressed and converted by numThreads worker threads
+     *  directly into the final IR storage.  numThreads = 0 uses one thread per hardware core
+     *  Only shuffle and deflate filters on little endian IEEE floats are supported
+     *  Other datasets fall back to the regular HDF5 read, isDirectChunkReadUsed() tells which path the last load took
+     *  This takes effect on the next call to readSOFAFile()
+     */
+    void BasicSOFA::setDirectChunkRead(bool enable, unsigned int numThreads)
+    {
+        directChunkRead = enable;
+        loaderThreads = numThreads;
+    }
+    
+    
+    /*
+     *  Convert every IR to targetFs while the file is loaded, so that no resampling is needed at run time
+     *  getFs() and getN() report the converted rate and length.  targetFs = 0 keeps the rate of the file
+     *  The conversion is spread over numThreads threads, numThreads = 0 uses one thread per hardware core
+     *  Both rates are rounded to whole Hz and their reduced ratio may not have an upsampling factor above maxResamplerPhases
+     *  This takes effect on the next call to readSOFAFile()
+     */
+    void BasicSOFA::setTargetSampleRate(double targetFs, unsigned int numThreads)
+    {
+        this->targetFs = targetFs;
+        resamplerThreads = numThreads;
+    }
+    
+    
+    /*
+     *  Store the IRs as 16 bit samples with a scale factor per IR, cutting the IR memory by 4x compared to Double
+     *  IRs are encoded once the file is read, so other load options (eg. resampling) work on full precision data
+     *  The 16 bit formats are always stored contiguously, padded as selected with setIRLayout()
+     *  readSOFAFile() fails if a 16 bit format is combined with the interleaved layout
+     *  getHRIR() and getHRIRBlock() return nullptr with these formats, use copyHRIR() to decode an IR instead
+     *  The worst case error relative to the peak of each IR is 1/65534 for Int16 (half a step of peak / 32767) and 2^-11 for Float16
+     *  This takes effect on the next call to readSOFAFile()
+     */
+    void BasicSOFA::setSampleFormat(SOFASampleFormat format)
+    {
+        requestedFormat = format;
+    }
+    
+    
+    /*
+     *  Render sources at any distance from the IRs measured at a single reference radius
+     *  Only the IRs at referenceRadius are loaded.  referenceRadius = 0 picks the largest radius in the file
+     *  Other distances are rendered by applying a near-field correction filter, a propagation delay and a 1/r gain
+     *  to the reference IR (see getDistanceModelledHRIR())
+     *  Requires a set with two receivers, the left ear first
+     *  This takes effect on the next call to readSOFAFile()
+     */
+    void BasicSOFA::setDistanceModel(bool enable, double referenceRadius, double headRadius)
+    {
+        distanceModelEnabled = enable;
+        requestedReferenceRadius = referenceRadius;
+        this->headRadius = headRadius;
+    }
+    
+    
+    /*
+     *  Derive binaural Ambisonic decoder filters from the loaded IRs, so a scene can be rendered through an order N
+     *  Ambisonic mix with R x (N + 1)^2 convolutions regardless of the number of sources
+     *
+     *  Channels use ACN ordering with SN3D normalisation (AmbiX), see getAmbisonicCoefficients()
+     *  The filters are a regularised least squares fit over every direction measured at the given radius (0 picks the radius
+     *  with the most directions).  Above magLSCutoff, only the magnitude is fitted (MagLS) since the IR phase cannot be
+     *  reproduced at low orders.  A cutoff of 0 uses order * c / (2 * pi * headRadius), roughly 600 Hz per order
+     *  With frequencyDomain set, the spectra of the filters are also kept for overlap-save convolution
+     *  The fit runs on numThreads threads (0 uses every hardware thread).  This takes effect on the next call to readSOFAFile()
+     */
+    void BasicSOFA::setAmbisonicDecoder(bool enable, unsigned int order, double radius, bool frequencyDomain, double magLSCutoff, unsigned int numThreads)
+    {
+        ambisonicDecoderEnabled = enable;
+        requestedAmbisonicOrder = order;
+        ambisonicRadius = radius;
+        ambisonicSpectraEnabled = frequencyDomain;
+        this->magLSCutoff = magLSCutoff;
+        ambisonicThreads = numThreads;
+    }
+    
+    
+    /*
+     *  Return the decoder filter from Ambisonic channel acn to receiver channel, getAmbisonicFilterLength() samples long
+     *  The binaural output of a receiver is the sum of every Ambisonic channel convolved with its filter
+     */
+    const double* BasicSOFA::getAmbisonicFilter(size_t channel, size_t acn) const noexcept
+    {
+        auto numChannels = getNumAmbisonicChannels();
+        if (channel >= R || acn >= numChannels)
+            return nullptr;
+        
+        return ambisonicFilters.data() + (((channel * numChannels) + acn) * ambisonicLength);
+    }
+    
+    
+    /*
+     *  Return the first getAmbisonicSpectrumSize() bins of the FFT of a decoder filter zero padded to 2 * getAmbisonicFilterLength()
+     *  ie. ready for overlap-save convolution with blocks of getAmbisonicFilterLength() samples
+     *  Only available when the decoder was built with frequencyDomain set
+     */
+    const std::complex<double>* BasicSOFA::getAmbisonicSpectrum(size_t channel, size_t acn) const noexcept
+    {
+        auto numChannels = getNumAmbisonicChannels();
+        if (ambisonicSpectra.size() == 0 || channel >= R || acn >= numChannels)
+            return nullptr;
+        
+        return ambisonicSpectra.data() + (((channel * numChannels) + acn) * (ambisonicLength + 1));
+    }
+    
+    
+    /*
+     *  Real spherical harmonics up to the given order for a direction (in degrees), in ACN order with SN3D normalisation
+     *  These are the gains that encode a source into the Ambisonic mix.  coefficients must hold (order + 1)^2 values
+     */
+    void BasicSOFA::getAmbisonicCoefficients(unsigned int order, double theta, double phi, double *coefficients)
+    {
+        auto azimuth = theta * M_PI / 180.0;
+        auto sinElevation = sin(phi * M_PI / 180.0);
+        auto cosElevation = cos(phi * M_PI / 180.0);
+        
+        //  Associated Legendre functions P[n][m] of sin(elevation), without the Condon-Shortley phase
+        std::vector<double> legendre((order + 1) * (order + 1), 0.0);
+        auto P = [&](size_t n, size_t m) -> double& { return legendre[(n * (order + 1)) + m]; };
+        
+        P(0, 0) = 1.0;
+        for (size_t m = 0; m <= order; ++m)
+        {
+            if (m > 0)
+                P(m, m) = (2 * m - 1) * cosElevation * P(m - 1, m - 1);
+            
+            if (m + 1 <= order)
+                P(m + 1, m) = (2 * m + 1) * sinElevation * P(m, m);
+            
+            for (auto n = m + 2; n <= order; ++n)
+                P(n, m) = (((2 * n - 1) * sinElevation * P(n - 1, m)) - ((n + m - 1) * P(n - 2, m))) / (n - m);
+        }
+        
+        for (int n = 0; n <= static_cast<int>(order); ++n)
+        {
+            for (int m = -n; m <= n; ++m)
+            {
+                auto absM = std::abs(m);
+                
+                //  (n - |m|)! / (n + |m|)!
+                double factorialRatio = 1.0;
+                for (auto k = n - absM + 1; k <= n + absM; ++k)
+                    factorialRatio /= k;
+                
+                auto normalisation = sqrt((m == 0 ? 1.0 : 2.0) * factorialRatio);
+                auto azimuthTerm = m >= 0 ? cos(m * azimuth) : sin(absM * azimuth);
+                
+                coefficients[(n * n) + n + m] = normalisation * P(n, absM) * azimuthTerm;
+            }
+        }
+    }
+    
+    
+    /*
+     *  Derive cheaper rendering data for every direction at load, so a scheduler can trade quality for CPU per source
+     *  - A parametric table of ITD, ILD and broadband gain, see getParametricHRIR().  ITD and ILD need a set with two receivers, left ear first
+     *  - Short IRs of each length in shortLengths, see getShortHRIR().  Lengths longer than N are clamped to N
+     *  This takes effect on the next call to readSOFAFile()
+     */
+    void BasicSOFA::setLevelOfDetail(bool enable, const std::vector<size_t> &shortLengths)
+    {
+        lodEnabled = enable;
+        requestedLODLengths = shortLengths;
+    }
+    
+    
+    bool BasicSOFA::getParametricHRIR(double theta, double phi, double radius, SOFAParametricHRIR &parameters) const noexcept
+    {
+        if (!dataLoaded || parametricTable.size() == 0)
+            return false;
+        
+        size_t irIndex;
+        if (!findIRIndex(theta, phi, radius, irIndex))
+            return false;
+        
+        parameters = parametricTable[irIndex];
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Return a short IR of the given length for a direction, or nullptr if no tier of that length was built
+     *  The short IR is the window of the full IR holding the most energy, which is the least squares approximation of the
+     *  full IR by length taps and a delay.  delay is set to the position of the window, in samples, and the short IR has to
+     *  be delayed by it to line up with the full IR
+     */
+    const double* BasicSOFA::getShortHRIR(size_t channel, double theta, double phi, double radius, size_t length, size_t &delay) const noexcept
+    {
+        if (!dataLoaded || channel >= R)
+            return nullptr;
+        
+        auto tier = std::find_if(shortTiers.begin(), shortTiers.end(), [length](const ShortHRIRTier &t) { return t.length == length; });
+        if (tier == shortTiers.end())
+            return nullptr;
+        
+        size_t irIndex;
+        if (!findIRIndex(theta, phi, radius, irIndex))
             return nullptr;
         
-        auto irIndex = map.map.at(phiIt->second).at(thetaIt->second);
+        delay = tier->delays[(irIndex * R) + channel];
+        
+        return tier->hrir.data() + (((irIndex * R) + channel) * length);
+    }
+    
+    
+    std::vector<size_t> BasicSOFA::getShortHRIRLengths() const
+    {
+        std::vector<size_t> lengths;
+        for (const auto &tier : shortTiers)
+            lengths.push_back(tier.length);
+        
+        return lengths;
+    }
+    
+    
+    /*
+     *  Write the IR for a source at an arbitrary distance (in metres) into dest, which must hold at least getN() samples
+     *
+     *  The IR measured at the reference radius is filtered with a zero phase near-field correction filter.
+     *  The filter is interpolated from a bank indexed by the angle between the source and the ear and by distance
+     *  It is then scaled by referenceRadius / distance and, if applyDelay is set, shifted by getDistanceDelay()
+     *  The IR cannot be moved earlier than its first impulse peak (getMinImpulseDelay()) and anything pushed past N is lost
+     *  so renderers covering large distance changes should pass applyDelay = false and delay the source themselves
+     *  Distances outside of the filter bank use the nearest filter but still get the exact delay and gain
+     */
+    bool BasicSOFA::getDistanceModelledHRIR(size_t channel, double theta, double phi, double distance, double *dest, bool applyDelay) const noexcept
+    {
+        if (!dataLoaded || !distanceModelEnabled || nearFieldFilters.size() == 0)
+            return false;
+        
+        if (R != 2 || channel >= R || dest == nullptr || distance <= headRadius)
+            return false;
+        
+        size_t irIndex;
+        if (!findIRIndex(theta, phi, referenceRadius, irIndex) || !decodeHRIR(irIndex, channel, dest))
+            return false;
+        
+        //  Angle between the source and the ear, the left ear sits at theta = 90 and the right ear at theta = -90
+        auto cosIncidence = cos(phi * M_PI / 180.0) * sin(theta * M_PI / 180.0);
+        if (channel == 1)
+            cosIncidence = -cosIncidence;
+        
+        auto incidence = acos(std::min(1.0, std::max(-1.0, cosIncidence))) * 180.0 / M_PI;
+        auto numAngles = nearFieldFilters.size() / (nearFieldNumDistances * (nearFieldHalfLength + 1));
+        auto angleIndex = std::min(static_cast<size_t>(incidence / nearFieldAngleStep), numAngles - 2);
+        auto angleWeight = std::min(1.0, (incidence / nearFieldAngleStep) - angleIndex);
+        
+        //  Filters are spaced logarithmically in distance
+        auto clampedDistance = std::min(nearFieldDistances.back(), std::max(nearFieldDistances.front(), distance));
+        auto distanceIt = std::upper_bound(nearFieldDistances.begin(), nearFieldDistances.end() - 1, clampedDistance);
+        size_t distanceIndex = std::max<ptrdiff_t>(distanceIt - nearFieldDistances.begin(), 1) - 1;
+        auto distanceWeight = log(clampedDistance / nearFieldDistances[distanceIndex]) / log(nearFieldDistances[distanceIndex + 1] / nearFieldDistances[distanceIndex]);
+        
+        double filter[nearFieldHalfLength + 1];
+        const double weights[4] = {(1 - angleWeight) * (1 - distanceWeight), (1 - angleWeight) * distanceWeight, angleWeight * (1 - distanceWeight), angleWeight * distanceWeight};
+        const double *filters[4] =
+        {
+            nearFieldFilters.data() + (((angleIndex * nearFieldNumDistances) + distanceIndex) * (nearFieldHalfLength + 1)),
+            nearFieldFilters.data() + (((angleIndex * nearFieldNumDistances) + distanceIndex + 1) * (nearFieldHalfLength + 1)),
+            nearFieldFilters.data() + ((((angleIndex + 1) * nearFieldNumDistances) + distanceIndex) * (nearFieldHalfLength + 1)),
+            nearFieldFilters.data() + ((((angleIndex + 1) * nearFieldNumDistances) + distanceIndex + 1) * (nearFieldHalfLength + 1))
+        };
+        
+        for (size_t k = 0; k <= nearFieldHalfLength; ++k)
+            filter[k] = (weights[0] * filters[0][k]) + (weights[1] * filters[1][k]) + (weights[2] * filters[2][k]) + (weights[3] * filters[3][k]);
+        
+        auto gain = referenceRadius / distance;
+        long delay = applyDelay ? std::max(lround(getDistanceDelay(distance)), -static_cast<long>(minImpulseDelay)) : 0;
+        long length = static_cast<long>(N);
+        
+        //  Filter in place
+        //  Inputs behind the current sample have already been overwritten so they are kept in a ring buffer
+        double history[nearFieldHalfLength];
+        
+        for (long n = 0; n < length; ++n)
+        {
+            auto x = dest[n];
+            auto sum = filter[0] * x;
+            
+            for (long k = 1; k <= static_cast<long>(nearFieldHalfLength); ++k)
+            {
+                if (n - k >= 0)
+                    sum += filter[k] * history[(n - k) % nearFieldHalfLength];
+                if (n + k < length)
+                    sum += filter[k] * dest[n + k];
+            }
+            
+            history[n % nearFieldHalfLength] = x;
+            dest[n] = gain * sum;
+        }
+        
+        if (delay > 0)
+        {
+            auto shift = std::min(delay, length);
+            memmove(dest + shift, dest, (length - shift) * sizeof(double));
+            std::fill(dest, dest + shift, 0.0);
+        }
+        else if (delay < 0)
+        {
+            auto shift = std::min(-delay, length);
+            memmove(dest, dest + shift, (length - shift) * sizeof(double));
+            std::fill(dest + (length - shift), dest + length, 0.0);
+        }
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Difference in propagation delay, in samples, between a source at distance and one at the reference radius
+     */
+    double BasicSOFA::getDistanceDelay(double distance) const
+    {
+        return ((distance - referenceRadius) / speedOfSound) * fs;
+    }
+    
+    
+    SOFALayoutDescriptor BasicSOFA::getLayoutDescriptor() const
+    {
+        SOFALayoutDescriptor descriptor;
+        
+        //  16 bit formats are stored contiguously, see encodeHRIRData()
+        descriptor.layout = irLayout;
+        descriptor.length = N;
+        descriptor.paddedLength = paddedN;
+        descriptor.padding = paddedN - N;
+        
+        if (irLayout == SOFAIRLayout::Interleaved)
+        {
+            descriptor.sampleStride = R;
+            descriptor.receiverStride = 1;
+        }
+        else
+        {
+            descriptor.sampleStride = 1;
+            descriptor.receiverStride = paddedN;
+        }
+        
+        descriptor.measurementStride = R * paddedN;
+        
+        //  The storage itself is SOFA_IR_ALIGNMENT aligned, so every IR (or block when interleaved) is
+        //  aligned to the largest power of two dividing its stride in bytes, up to SOFA_IR_ALIGNMENT
+        size_t sampleSize = sampleFormat == SOFASampleFormat::Double ? sizeof(double) : sizeof(uint16_t);
+        size_t strideBytes = sampleSize * (irLayout == SOFAIRLayout::Interleaved ? descriptor.measurementStride : descriptor.receiverStride);
+        
+        descriptor.alignment = SOFA_IR_ALIGNMENT;
+        while (descriptor.alignment > sampleSize && strideBytes % descriptor.alignment != 0)
+            descriptor.alignment /= 2;
+        
+        return descriptor;
+    }
+    
+    
+    /*
+     *  Approximate number of bytes held by the loaded IRs and the lookup tables built for them
+     *  Hash map nodes are estimated as the key, the value and two pointers
+     */
+    size_t BasicSOFA::getMemoryUsage() const
+    {
+        const size_t mapNodeSize = sizeof(double) + sizeof(size_t) + (2 * sizeof(void*));
+        
+        size_t bytes = hrir.capacity() * sizeof(double);
+        bytes += (thetaList.capacity() + phiList.capacity() + radiusList.capacity()) * sizeof(double);
+        bytes += (nearFieldDistances.capacity() + nearFieldFilters.capacity()) * sizeof(double);
+        bytes += measurementRows.capacity() * sizeof(hsize_t);
+        bytes += (compressedHRIR.capacity() * sizeof(uint16_t)) + (irScales.capacity() * sizeof(double));
+        bytes += (ambisonicFilters.capacity() * sizeof(double)) + (ambisonicSpectra.capacity() * sizeof(std::complex<double>));
+        bytes += parametricTable.capacity() * sizeof(SOFAParametricHRIR);
+        
+        for (const auto &tier : shortTiers)
+            bytes += sizeof(tier) + (tier.hrir.capacity() * sizeof(double)) + (tier.delays.capacity() * sizeof(size_t));
+        bytes += (radiusMap.size() * mapNodeSize) + (radiusMap.bucket_count() * sizeof(void*));
+        
+        for (const auto &map : coordinateMaps)
+        {
+            bytes += sizeof(SOFACoordinateMap);
+            bytes += (map.phiMap.size() * mapNodeSize) + (map.phiMap.bucket_count() * sizeof(void*));
+            
+            for (const auto &row : map.map)
+                bytes += sizeof(row) + (row.capacity() * sizeof(size_t));
+            
+            for (const auto &thetaMap : map.thetaMaps)
+                bytes += sizeof(thetaMap) + (thetaMap.size() * mapNodeSize) + (thetaMap.bucket_count() * sizeof(void*));
+        }
         
-        return hrir.data() + ((irIndex * R) + channel) * N;
+        return bytes;
     }
     
     
@@ -285,28 +817,91 @@ namespace BasicSOFA
         N = 0;
         C = 0;
         R = 0;
-    }
-    
-    
-    std::vector<double> BasicSOFA::getCoordinatesFromSOFAFile()
-    {
-        std::vector<double> coordinates;
         
-        try
+        paddedN = 0;
+        directChunkReadUsed = false;
+        
+        if (measurementRows.size() != 0)
         {
-            auto dataSet = h5File.openDataSet(SOFA_SRC_POS_STRING);
-            auto dataSpace = dataSet.getSpace();
-            
-            //  According to the standard, the source and listener positions should have dimensionaltiy [M x C] or [I x C]
-            //  The object having M x C dimensionality contains the coordinate data
-            hsize_t dims[2];
-            dataSpace.getSimpleExtentDims(dims);
-            
-            if (dims[0] == M)
-            {
-                coordinates = std::vector<double>(M * C);
-                dataSet.read(coordinates.data(), H5::PredType::NATIVE_DOUBLE);
-            }
+            measurementRows.erase(measurementRows.begin(), measurementRows.end());
+            measurementRows.shrink_to_fit();
+        }
+        
+        if (nearFieldFilters.size() != 0)
+        {
+            nearFieldFilters.erase(nearFieldFilters.begin(), nearFieldFilters.end());
+            nearFieldFilters.shrink_to_fit();
+        }
+        
+        if (nearFieldDistances.size() != 0)
+        {
+            nearFieldDistances.erase(nearFieldDistances.begin(), nearFieldDistances.end());
+            nearFieldDistances.shrink_to_fit();
+        }
+        
+        if (compressedHRIR.size() != 0)
+        {
+            compressedHRIR.erase(compressedHRIR.begin(), compressedHRIR.end());
+            compressedHRIR.shrink_to_fit();
+        }
+        
+        if (irScales.size() != 0)
+        {
+            irScales.erase(irScales.begin(), irScales.end());
+            irScales.shrink_to_fit();
+        }
+        
+        if (ambisonicFilters.size() != 0)
+        {
+            ambisonicFilters.erase(ambisonicFilters.begin(), ambisonicFilters.end());
+            ambisonicFilters.shrink_to_fit();
+        }
+        
+        if (ambisonicSpectra.size() != 0)
+        {
+            ambisonicSpectra.erase(ambisonicSpectra.begin(), ambisonicSpectra.end());
+            ambisonicSpectra.shrink_to_fit();
+        }
+        
+        if (parametricTable.size() != 0)
+        {
+            parametricTable.erase(parametricTable.begin(), parametricTable.end());
+            parametricTable.shrink_to_fit();
+        }
+        
+        if (shortTiers.size() != 0)
+        {
+            shortTiers.erase(shortTiers.begin(), shortTiers.end());
+            shortTiers.shrink_to_fit();
+        }
+        
+        sampleFormat = SOFASampleFormat::Double;
+        ambisonicOrder = 0;
+        ambisonicLength = 0;
+        referenceRadius = 0;
+        dataLoaded = false;
+    }
+    
+    
+    std::vector<double> BasicSOFA::getCoordinatesFromSOFAFile()
+    {
+        std::vector<double> coordinates;
+        
+        try
+        {
+            auto dataSet = h5File.openDataSet(SOFA_SRC_POS_STRING);
+            auto dataSpace = dataSet.getSpace();
+            
+            //  According to the standard, the source and listener positions should have dimensionaltiy [M x C] or [I x C]
+            //  The object having M x C dimensionality contains the coordinate data
+            hsize_t dims[2];
+            dataSpace.getSimpleExtentDims(dims);
+            
+            if (dims[0] == M)
+            {
+                coordinates = std::vector<double>(M * C);
+                dataSet.read(coordinates.data(), H5::PredType::NATIVE_DOUBLE);
+            }
             
             dataSet = h5File.openDataSet(SOFA_LIS_POS_STRING);
             dataSpace = dataSet.getSpace();
@@ -342,6 +937,343 @@ namespace BasicSOFA
     }
     
     
+    /*
+     *  Read Data.IR into hrir using the selected layout
+     *  Without padding or interleaving, the dataset is read straight into hrir just like the file layout
+     *  Otherwise, batches of measurements are read into a scratch buffer and repacked
+     *  This keeps the extra memory needed during the load at readBatchSize bytes
+     */
+    bool BasicSOFA::readHRIRData(H5::DataSet &dataSet)
+    {
+        irLayout = requestedLayout;
+        padIRs = requestedPadding;
+        sampleFormat = SOFASampleFormat::Double;
+        paddedN = padIRs ? ((N + simdWidth - 1) / simdWidth) * simdWidth : N;
+        hrir = std::vector<double, SOFAAlignedAllocator<double>>(M * R * paddedN, 0.0);
+        
+        HRIRChunkFormat chunkFormat;
+        if (directChunkRead && getHRIRChunkFormat(dataSet, chunkFormat))
+        {
+            directChunkReadUsed = true;
+            return readHRIRChunks(dataSet, chunkFormat);
+        }
+        
+        if (irLayout == SOFAIRLayout::Contiguous && paddedN == N && measurementRows.size() == 0)
+        {
+            dataSet.read(hrir.data(), H5::PredType::NATIVE_DOUBLE);
+            return true;
+        }
+        
+        auto sampleStride = getLayoutDescriptor().sampleStride;
+        auto fileSpace = dataSet.getSpace();
+        
+        hsize_t batchSize = std::max<hsize_t>(1, readBatchSize / (R * N * sizeof(double)));
+        std::vector<double> scratch(batchSize * R * N);
+        
+        for (hsize_t start = 0; start < M; start += batchSize)
+        {
+            hsize_t count = std::min(batchSize, M - start);
+            
+            //  Select the file rows of this batch, merging consecutive rows into a single hyperslab
+            fileSpace.selectNone();
+            for (hsize_t m = 0; m < count;)
+            {
+                hsize_t row = getFileRow(start + m);
+                hsize_t numRows = 1;
+                while (m + numRows < count && getFileRow(start + m + numRows) == row + numRows)
+                    ++numRows;
+                
+                hsize_t fileOffset[3] = {row, 0, 0};
+                hsize_t fileCount[3] = {numRows, R, N};
+                fileSpace.selectHyperslab(H5S_SELECT_OR, fileCount, fileOffset);
+                
+                m += numRows;
+            }
+            
+            hsize_t memDims = count * R * N;
+            H5::DataSpace memSpace(1, &memDims);
+            dataSet.read(scratch.data(), H5::PredType::NATIVE_DOUBLE, memSpace, fileSpace);
+            
+            for (hsize_t block = 0; block < count * R; ++block)
+            {
+                const double *src = scratch.data() + (block * N);
+                double *dest = hrir.data() + getIROffset(start + (block / R), block % R);
+                
+                for (hsize_t n = 0; n < N; ++n)
+                    dest[n * sampleStride] = src[n];
+            }
+        }
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Check whether Data.IR can be decoded by the direct chunk reader and get its chunk format
+     */
+    bool BasicSOFA::getHRIRChunkFormat(H5::DataSet &dataSet, HRIRChunkFormat &format)
+    {
+        auto createPList = dataSet.getCreatePlist();
+        if (createPList.getLayout() != H5D_CHUNKED || createPList.getChunk(3, format.dims) != 3)
+            return false;
+        
+        //  Raw chunks are copied byte for byte so the stored type must already match a native little endian float
+        if (dataSet.getTypeClass() != H5T_FLOAT)
+            return false;
+        
+        auto dataType = dataSet.getFloatType();
+        if (dataType.getOrder() != H5T_ORDER_LE || H5::PredType::NATIVE_DOUBLE.getOrder() != H5T_ORDER_LE)
+            return false;
+        
+        if (dataType == H5::PredType::IEEE_F64LE)
+            format.elementSize = sizeof(double);
+        else if (dataType == H5::PredType::IEEE_F32LE)
+            format.elementSize = sizeof(float);
+        else
+            return false;
+        
+        dataSet.getSpace().getSimpleExtentDims(format.extents);
+        
+        format.rowToIndex.clear();
+        if (measurementRows.size() != 0)
+        {
+            format.rowToIndex = std::vector<size_t>(format.extents[0], SIZE_MAX);
+            for (size_t i = 0; i < measurementRows.size(); ++i)
+                format.rowToIndex[measurementRows[i]] = i;
+        }
+        
+        format.filters.clear();
+        auto numFilters = createPList.getNfilters();
+        for (auto i = 0; i < numFilters; ++i)
+        {
+            unsigned int flags;
+            size_t numValues = 0;
+            unsigned int filterConfig;
+            char name[32];
+            
+            auto filter = createPList.getFilter(i, flags, numValues, nullptr, sizeof(name), name, filterConfig);
+            if (filter != H5Z_FILTER_DEFLATE && filter != H5Z_FILTER_SHUFFLE)
+                return false;
+            
+            format.filters.push_back(filter);
+        }
+        
+        return true;
+    }
+    
+    
+    /*
+     *  HDF5 calls are not thread safe so raw chunks are read on the calling thread in batches
+     *  Each batch is then decoded in parallel, with every worker writing straight into hrir
+     *  Chunks never overlap so no locking is needed on the output
+     *  Extra memory during the load is limited to one batch of compressed chunks plus the decode scratch of each worker
+     */
+    bool BasicSOFA::readHRIRChunks(H5::DataSet &dataSet, const HRIRChunkFormat &format)
+    {
+        auto numThreads = loaderThreads > 0 ? loaderThreads : std::max(1u, std::thread::hardware_concurrency());
+        hsize_t numChunks[3];
+        
+        for (auto i = 0; i < 3; ++i)
+            numChunks[i] = (format.extents[i] + format.dims[i] - 1) / format.dims[i];
+        
+        auto totalChunks = numChunks[0] * numChunks[1] * numChunks[2];
+        auto batchSize = numThreads * chunksPerThread;
+        
+        std::vector<std::vector<unsigned char>> chunks(batchSize);
+        std::vector<uint32_t> filterMasks(batchSize);
+        std::vector<std::array<hsize_t, 3>> chunkOffsets(batchSize);
+        
+        for (hsize_t start = 0; start < totalChunks; start += batchSize)
+        {
+            auto count = std::min<hsize_t>(batchSize, totalChunks - start);
+            
+            for (hsize_t i = 0; i < count; ++i)
+            {
+                auto chunkIndex = start + i;
+                auto &offset = chunkOffsets[i];
+                offset[2] = (chunkIndex % numChunks[2]) * format.dims[2];
+                offset[1] = ((chunkIndex / numChunks[2]) % numChunks[1]) * format.dims[1];
+                offset[0] = (chunkIndex / (numChunks[2] * numChunks[1])) * format.dims[0];
+                
+                //  Chunks that were never written have no storage and are left as zeros
+                //  Chunks holding none of the loaded rows are skipped in the same way
+                hsize_t chunkBytes = 0;
+                if (format.rowToIndex.size() != 0)
+                {
+                    auto lastRow = std::min(offset[0] + format.dims[0], format.extents[0]);
+                    auto selected = std::find_if(format.rowToIndex.begin() + offset[0], format.rowToIndex.begin() + lastRow, [](size_t index) { return index != SIZE_MAX; });
+                    
+                    if (selected == format.rowToIndex.begin() + lastRow)
+                    {
+                        chunks[i].resize(0);
+                        continue;
+                    }
+                }
+                
+                if (H5Dget_chunk_storage_size(dataSet.getId(), offset.data(), &chunkBytes) < 0)
+                    return false;
+                
+                chunks[i].resize(chunkBytes);
+                if (chunkBytes == 0)
+                    continue;
+                
+                if (H5Dread_chunk(dataSet.getId(), H5P_DEFAULT, offset.data(), &filterMasks[i], chunks[i].data()) < 0)
+                    return false;
+            }
+            
+            std::atomic<hsize_t> nextChunk(0);
+            std::atomic<bool> success(true);
+            std::vector<std::thread> workers;
+            
+            for (hsize_t t = 0; t < std::min<hsize_t>(numThreads, count); ++t)
+            {
+                workers.push_back(std::thread([&]()
+                {
+                    for (auto i = nextChunk++; i < count && success; i = nextChunk++)
+                    {
+                        if (chunks[i].size() != 0 && !decodeHRIRChunk(chunks[i], filterMasks[i], chunkOffsets[i].data(), format))
+                            success = false;
+                    }
+                }));
+            }
+            
+            for (auto &worker : workers)
+                worker.join();
+            
+            if (!success)
+                return false;
+        }
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Undo the filters applied to a raw chunk and convert its samples into hrir
+     *  Filters are undone in the reverse order they were applied in, reading the first one straight from chunk
+     *  Scratch is only allocated for the filters that run, so a deflate-only chunk needs a single buffer
+     *  A set bit in filterMask means the corresponding filter was skipped for this chunk
+     *  Chunks on the dataset edges are stored at full size and are clipped to the dataset extents here
+     */
+    bool BasicSOFA::decodeHRIRChunk(const std::vector<unsigned char> &chunk, uint32_t filterMask, const hsize_t *chunkOffset, const HRIRChunkFormat &format)
+    {
+        size_t numElements = format.dims[0] * format.dims[1] * format.dims[2];
+        size_t numBytes = numElements * format.elementSize;
+        
+        const unsigned char *data = chunk.data();
+        size_t dataSize = chunk.size();
+        std::vector<unsigned char> buffers[2];
+        size_t nextBuffer = 0;
+        
+        for (auto i = static_cast<int>(format.filters.size()) - 1; i >= 0; --i)
+        {
+            if (filterMask & (1u << i))
+                continue;
+            
+            auto &output = buffers[nextBuffer];
+            output.resize(numBytes);
+            
+            if (format.filters[i] == H5Z_FILTER_DEFLATE)
+            {
+                uLongf decompressedSize = numBytes;
+                if (uncompress(output.data(), &decompressedSize, data, dataSize) != Z_OK || decompressedSize != numBytes)
+                    return false;
+            }
+            else
+            {
+                if (dataSize != numBytes)
+                    return false;
+                
+                for (size_t byte = 0; byte < format.elementSize; ++byte)
+                {
+                    for (size_t element = 0; element < numElements; ++element)
+                        output[(element * format.elementSize) + byte] = data[(byte * numElements) + element];
+                }
+            }
+            
+            data = output.data();
+            dataSize = numBytes;
+            nextBuffer ^= 1;
+        }
+        
+        if (dataSize != numBytes)
+            return false;
+        
+        auto sampleStride = getLayoutDescriptor().sampleStride;
+        auto numMeasurements = std::min<hsize_t>(format.dims[0], format.extents[0] - chunkOffset[0]);
+        auto numReceivers = std::min<hsize_t>(format.dims[1], format.extents[1] - chunkOffset[1]);
+        auto numSamples = std::min<hsize_t>(format.dims[2], format.extents[2] - chunkOffset[2]);
+        
+        for (hsize_t m = 0; m < numMeasurements; ++m)
+        {
+            size_t irIndex = chunkOffset[0] + m;
+            if (format.rowToIndex.size() != 0)
+                irIndex = format.rowToIndex[irIndex];
+            
+            if (irIndex == SIZE_MAX)
+                continue;
+            
+            for (hsize_t r = 0; r < numReceivers; ++r)
+            {
+                double *dest = hrir.data() + getIROffset(irIndex, chunkOffset[1] + r) + (chunkOffset[2] * sampleStride);
+                auto src = data + (((m * format.dims[1]) + r) * format.dims[2] * format.elementSize);
+                
+                for (hsize_t n = 0; n < numSamples; ++n)
+                {
+                    if (format.elementSize == sizeof(float))
+                    {
+                        float sample;
+                        memcpy(&sample, src + (n * sizeof(float)), sizeof(float));
+                        dest[n * sampleStride] = sample;
+                    }
+                    else
+                        memcpy(dest + (n * sampleStride), src + (n * sizeof(double)), sizeof(double));
+                }
+            }
+        }
+        
+        return true;
+    }
+    
+    
+    bool BasicSOFA::findIRIndex(double theta, double phi, double radius, size_t &irIndex) const noexcept
+    {
+        auto radiusIt = radiusMap.find(round(radius));
+        if (radiusIt == radiusMap.end())
+            return false;
+        
+        const auto &map = coordinateMaps.at(radiusIt->second);
+        
+        auto phiIt = map.phiMap.find(round(phi));
+        if (phiIt == map.phiMap.end())
+            return false;
+        
+        const auto &thetaMap = map.thetaMaps.at(phiIt->second);
+        auto thetaIt = thetaMap.find(round(theta));
+        if (thetaIt == thetaMap.end())
+            return false;
+        
+        irIndex = map.map.at(phiIt->second).at(thetaIt->second);
+        
+        return true;
+    }
+    
+    
+    size_t BasicSOFA::getIROffset(size_t irIndex, size_t channel) const noexcept
+    {
+        if (irLayout == SOFAIRLayout::Interleaved)
+            return (irIndex * R * paddedN) + channel;
+        
+        return ((irIndex * R) + channel) * paddedN;
+    }
+    
+    
+    size_t BasicSOFA::getFileRow(size_t irIndex) const noexcept
+    {
+        return measurementRows.size() != 0 ? measurementRows[irIndex] : irIndex;
+    }
+    
+    
     hsize_t BasicSOFA::getSOFASingleDimParameterSize(std::string parameter)
     {
         hsize_t dim;
@@ -453,7 +1385,8 @@ namespace BasicSOFA
         std::sort(thetaList.begin(), thetaList.end());
         std::sort(phiList.begin(), phiList.end());
         
-        auto delta = round(radiusList[1] - radiusList[0]);
+        //  Sets measured at a single radius (or a single phi or theta) have no spacing
+        auto delta = radiusList.size() > 1 ? round(radiusList[1] - radiusList[0]) : 0.0;
         for (auto i = 2; i < radiusList.size() - 1; ++i)
         {
             if (round(radiusList[i] - radiusList[i - 1]) != delta)
@@ -464,7 +1397,7 @@ namespace BasicSOFA
         maxRadius = radiusList.at(radiusList.size() - 1);
         
         
-        delta = abs(round(thetaList[1] - thetaList[0]));
+        delta = thetaList.size() > 1 ? abs(round(thetaList[1] - thetaList[0])) : 0.0;
         for (auto i = 2; i < thetaList.size() - 1; ++i)
         {
             if (abs(round(thetaList[i] - thetaList[i - 1])) != delta)
@@ -475,7 +1408,7 @@ namespace BasicSOFA
         maxTheta = thetaList.at(thetaList.size() - 1);
         
         
-        delta = abs(round(phiList[1] - phiList[0]));
+        delta = phiList.size() > 1 ? abs(round(phiList[1] - phiList[0])) : 0.0;
         for (auto i = 2; i < phiList.size() - 1; ++i)
         {
             if (abs(round(phiList[i] - phiList[i - 1])) != delta)
@@ -518,28 +1451,973 @@ namespace BasicSOFA
             return false;
         
         minImpulseDelay = N;
+        auto sampleStride = getLayoutDescriptor().sampleStride;
         
-        for (auto i = 0; i < M; ++i)
+        for (size_t i = 0; i < M; ++i)
         {
-            double hrirMax = 0.0;
-            size_t maxLocation = 0;
-            
-            for (auto j = i * N; j < (i * N) + N; ++j)
+            for (size_t channel = 0; channel < R; ++channel)
             {
-                if (hrirMax < abs(hrir[j]))
+                const double *ir = hrir.data() + getIROffset(i, channel);
+                double hrirMax = 0.0;
+                size_t maxLocation = 0;
+                
+                for (size_t j = 0; j < N; ++j)
                 {
-                    hrirMax = abs(hrir[j]);
-                    maxLocation = j;
+                    if (hrirMax < abs(ir[j * sampleStride]))
+                    {
+                        hrirMax = abs(ir[j * sampleStride]);
+                        maxLocation = j;
+                    }
                 }
+                
+                if (maxLocation < minImpulseDelay)
+                    minImpulseDelay = maxLocation;
             }
+        }
+        
+        return true;
+    }
+        
+    
+    /*
+     *  Keep only the measurements taken at the reference radius
+     *  coordinates is compacted in place and measurementRows records the file row of every measurement kept
+     */
+    bool BasicSOFA::selectReferenceRadius(std::vector<double> &coordinates)
+    {
+        auto numBlocks = coordinates.size() / C;
+        auto radius = round(requestedReferenceRadius);
+        
+        if (requestedReferenceRadius <= 0)
+        {
+            radius = 0;
+            for (size_t block = 0; block < numBlocks; ++block)
+                radius = std::max(radius, round(coordinates.at((block * C) + (C - 1))));
+        }
+        
+        std::vector<double> selected;
+        measurementRows.clear();
+        
+        for (size_t block = 0; block < numBlocks; ++block)
+        {
+            if (round(coordinates.at((block * C) + (C - 1))) != radius)
+                continue;
             
-            if (maxLocation < minImpulseDelay)
-                minImpulseDelay = maxLocation;
+            measurementRows.push_back(block);
+            selected.insert(selected.end(), coordinates.begin() + (block * C), coordinates.begin() + ((block + 1) * C));
         }
         
+        if (measurementRows.size() == 0)
+            return false;
+        
+        //  Every row is at the reference radius, so the file can be read as is
+        if (measurementRows.size() == numBlocks)
+            measurementRows.clear();
+        
+        coordinates.swap(selected);
+        M = coordinates.size() / C;
+        referenceRadius = radius;
+        
         return true;
     }
     
+    
+    /*
+     *  Precompute the near-field correction filters used by getDistanceModelledHRIR()
+     *
+     *  For every incidence angle and distance in the bank, the target response is the ratio between the spherical head
+     *  magnitude response at that distance and the one at the reference radius
+     *  Each filter is designed as a zero phase FIR by frequency sampling followed by a Hann window
+     *  Since the filters are symmetric, only taps 0 to nearFieldHalfLength are stored
+     */
+    void BasicSOFA::buildNearFieldFilterBank()
+    {
+        auto numAngles = static_cast<size_t>(180.0 / nearFieldAngleStep) + 1;
+        auto numBins = (nearFieldDesignSize / 2) + 1;
+        auto minDistance = 1.2 * headRadius;
+        auto maxDistance = std::max(2.0 * referenceRadius, 3.0);
+        
+        nearFieldDistances = std::vector<double>(nearFieldNumDistances);
+        for (size_t i = 0; i < nearFieldNumDistances; ++i)
+            nearFieldDistances[i] = minDistance * pow(maxDistance / minDistance, static_cast<double>(i) / (nearFieldNumDistances - 1));
+        
+        //  The response is undefined at DC so the first bin is evaluated slightly above it
+        std::vector<double> binFrequencies(numBins);
+        for (size_t bin = 0; bin < numBins; ++bin)
+            binFrequencies[bin] = (bin == 0 ? 0.125 : bin) * fs / nearFieldDesignSize;
+        
+        std::vector<double> magnitudes(numAngles);
+        std::vector<double> reference(numBins * numAngles);
+        for (size_t bin = 0; bin < numBins; ++bin)
+        {
+            getSphericalHeadMagnitudes(referenceRadius, binFrequencies[bin], magnitudes);
+            std::copy(magnitudes.begin(), magnitudes.end(), reference.begin() + (bin * numAngles));
+        }
+        
+        std::vector<double> cosTable((nearFieldHalfLength + 1) * numBins);
+        for (size_t k = 0; k <= nearFieldHalfLength; ++k)
+        {
+            for (size_t bin = 0; bin < numBins; ++bin)
+                cosTable[(k * numBins) + bin] = cos((2.0 * M_PI * bin * k) / nearFieldDesignSize);
+        }
+        
+        nearFieldFilters = std::vector<double>(numAngles * nearFieldNumDistances * (nearFieldHalfLength + 1));
+        std::vector<double> gains(numAngles * numBins);
+        
+        for (size_t d = 0; d < nearFieldNumDistances; ++d)
+        {
+            for (size_t bin = 0; bin < numBins; ++bin)
+            {
+                getSphericalHeadMagnitudes(nearFieldDistances[d], binFrequencies[bin], magnitudes);
+                for (size_t a = 0; a < numAngles; ++a)
+                    gains[(a * numBins) + bin] = magnitudes[a] / reference[(bin * numAngles) + a];
+            }
+            
+            for (size_t a = 0; a < numAngles; ++a)
+            {
+                const double *gain = gains.data() + (a * numBins);
+                double *filter = nearFieldFilters.data() + (((a * nearFieldNumDistances) + d) * (nearFieldHalfLength + 1));
+                
+                for (size_t k = 0; k <= nearFieldHalfLength; ++k)
+                {
+                    const double *cosines = cosTable.data() + (k * numBins);
+                    double sum = gain[0] + (gain[numBins - 1] * cosines[numBins - 1]);
+                    
+                    for (size_t bin = 1; bin < numBins - 1; ++bin)
+                        sum += 2.0 * gain[bin] * cosines[bin];
+                    
+                    auto window = 0.5 * (1.0 + cos((M_PI * k) / (nearFieldHalfLength + 1)));
+                    filter[k] = window * sum / nearFieldDesignSize;
+                }
+            }
+        }
+    }
+    
+    
+    /*
+     *  Magnitude response of a rigid spherical head at every incidence angle of the filter bank, for a point source
+     *  at the given distance from the centre of the head:
+     *
+     *  |H| = (rho / mu) * | sum_m (2m + 1) * P_m(cos(angle)) * h_m(mu * rho) / h_m'(mu) |
+     *
+     *  where mu = 2 * pi * f * a / c, rho = distance / a and h_m is the spherical Hankel function of the first kind
+     *  H is normalised to the free field pressure at the centre of the head so it excludes the distance gain and delay
+     *  See Duda and Martens, "Range dependence of the response of a spherical head model", JASA 1998
+     */
+    void BasicSOFA::getSphericalHeadMagnitudes(double distance, double frequency, std::vector<double> &magnitudes) const
+    {
+        const std::complex<double> j(0.0, 1.0);
+        const double threshold = 1e-10;
+        const int maxTerms = 1000;
+        
+        auto numAngles = magnitudes.size();
+        auto mu = (2.0 * M_PI * frequency * headRadius) / speedOfSound;
+        auto rho = distance / headRadius;
+        auto z = mu * rho;
+        
+        //  Hankel functions come from the upward recurrence h_m+1(x) = ((2m + 1) / x) * h_m(x) - h_m-1(x)
+        //  starting from h_-1(x) = e^(jx) / x and h_0(x) = -j * e^(jx) / x
+        auto hrPrev = std::exp(j * z) / z;
+        auto hr = -j * hrPrev;
+        auto haPrev = std::exp(j * mu) / mu;
+        auto ha = -j * haPrev;
+        
+        std::vector<std::complex<double>> sums(numAngles, 0.0);
+        std::vector<double> legendrePrev(numAngles, 0.0);
+        std::vector<double> legendre(numAngles, 1.0);
+        std::vector<double> x(numAngles);
+        
+        for (size_t a = 0; a < numAngles; ++a)
+            x[a] = cos(a * nearFieldAngleStep * M_PI / 180.0);
+        
+        double largestSum = 0.0;
+        
+        for (auto m = 0; m < maxTerms; ++m)
+        {
+            auto haDerivative = haPrev - (((m + 1.0) / mu) * ha);
+            auto ratio = (2.0 * m + 1.0) * hr / haDerivative;
+            if (!std::isfinite(ratio.real()) || !std::isfinite(ratio.imag()))
+                break;
+            
+            for (size_t a = 0; a < numAngles; ++a)
+            {
+                sums[a] += legendre[a] * ratio;
+                largestSum = std::max(largestSum, std::abs(sums[a]));
+                
+                auto next = (((2.0 * m + 1.0) * x[a] * legendre[a]) - (m * legendrePrev[a])) / (m + 1.0);
+                legendrePrev[a] = legendre[a];
+                legendre[a] = next;
+            }
+            
+            //  |P_m| <= 1, so once past the oscillating terms a small ratio bounds the remaining terms at every angle
+            if (m > mu + 10 && std::abs(ratio) < threshold * largestSum)
+                break;
+            
+            auto hrNext = (((2.0 * m + 1.0) / z) * hr) - hrPrev;
+            hrPrev = hr;
+            hr = hrNext;
+            
+            auto haNext = (((2.0 * m + 1.0) / mu) * ha) - haPrev;
+            haPrev = ha;
+            ha = haNext;
+        }
+        
+        for (size_t a = 0; a < numAngles; ++a)
+            magnitudes[a] = (rho / mu) * std::abs(sums[a]);
+    }
+    
+    
+    /*
+     *  Polyphase resampling of every IR from fs to targetFs
+     *
+     *  With fs and targetFs reduced to an upsampling factor L and a downsampling factor D, output sample m sits at input time m * D / L
+     *  Its fractional position selects one of L phases of a Kaiser windowed sinc, precomputed as contiguous rows of taps
+     *  Every IR is copied into a zero padded scratch buffer first so the dot product with a phase row runs without bounds checks
+     *  IRs are split evenly between the threads and written into a new buffer in the same layout as hrir
+     */
+    bool BasicSOFA::resampleHRIRData()
+    {
+        auto inputRate = llround(fs);
+        auto outputRate = llround(targetFs);
+        if (inputRate <= 0 || outputRate <= 0)
+            return false;
+        
+        auto divisor = std::gcd(inputRate, outputRate);
+        size_t upFactor = outputRate / divisor;
+        size_t downFactor = inputRate / divisor;
+        if (upFactor > maxResamplerPhases)
+            return false;
+        
+        //  Interpolating kernel in units of input samples
+        auto cutoff = resamplerRolloff * std::min(1.0, static_cast<double>(upFactor) / downFactor) * 0.5;
+        auto halfTaps = static_cast<size_t>(ceil(resamplerZeroCrossings / (4.0 * cutoff))) * 2;    //  Keeps numTaps a multiple of 4
+        auto numTaps = 2 * halfTaps;
+        auto kaiserNorm = besselI0(resamplerKaiserBeta);
+        
+        std::vector<double> phases(upFactor * numTaps);
+        for (size_t phase = 0; phase < upFactor; ++phase)
+        {
+            for (size_t tap = 0; tap < numTaps; ++tap)
+            {
+                //  Tap k multiplies input sample (n0 - halfTaps + 1 + k) for an output at n0 + phase / L
+                auto t = (static_cast<double>(phase) / upFactor) + halfTaps - 1.0 - tap;
+                auto x = t / halfTaps;
+                auto window = fabs(x) < 1.0 ? besselI0(resamplerKaiserBeta * sqrt(1.0 - (x * x))) / kaiserNorm : 0.0;
+                auto sinc = t == 0.0 ? 1.0 : sin(2.0 * M_PI * cutoff * t) / (2.0 * M_PI * cutoff * t);
+                
+                phases[(phase * numTaps) + tap] = 2.0 * cutoff * sinc * window;
+            }
+        }
+        
+        auto inputLayout = getLayoutDescriptor();
+        auto outputN = ((N * upFactor) + downFactor - 1) / downFactor;
+        auto outputPaddedN = padIRs ? ((outputN + simdWidth - 1) / simdWidth) * simdWidth : outputN;
+        std::vector<double, SOFAAlignedAllocator<double>> resampled(M * R * outputPaddedN, 0.0);
+        
+        //  The layout of the output buffer, see getIROffset()
+        auto outputOffset = [&](size_t irIndex, size_t channel)
+        {
+            if (irLayout == SOFAIRLayout::Interleaved)
+                return (irIndex * R * outputPaddedN) + channel;
+            
+            return ((irIndex * R) + channel) * outputPaddedN;
+        };
+        
+        auto numThreads = resamplerThreads > 0 ? resamplerThreads : std::max(1u, std::thread::hardware_concurrency());
+        auto numIRs = M * R;
+        auto irsPerThread = (numIRs + numThreads - 1) / numThreads;
+        std::vector<std::thread> workers;
+        
+        for (size_t t = 0; t < numThreads; ++t)
+        {
+            auto first = t * irsPerThread;
+            auto last = std::min<size_t>(numIRs, first + irsPerThread);
+            if (first >= last)
+                break;
+            
+            workers.push_back(std::thread([&, first, last]()
+            {
+                std::vector<double> input(N + (2 * numTaps), 0.0);
+                
+                for (auto ir = first; ir < last; ++ir)
+                {
+                    auto irIndex = ir / R;
+                    auto channel = ir % R;
+                    const double *src = hrir.data() + getIROffset(irIndex, channel);
+                    double *dest = resampled.data() + outputOffset(irIndex, channel);
+                    
+                    for (size_t n = 0; n < N; ++n)
+                        input[numTaps + n] = src[n * inputLayout.sampleStride];
+                    
+                    for (size_t m = 0; m < outputN; ++m)
+                    {
+                        auto position = m * downFactor;
+                        auto n0 = position / upFactor;
+                        const double *taps = phases.data() + ((position % upFactor) * numTaps);
+                        const double *x = input.data() + numTaps + n0 + 1 - halfTaps;
+                        
+                        //  Independent accumulators let the compiler vectorise the dot product without reassociating a single sum
+                        double sums[4] = {0.0, 0.0, 0.0, 0.0};
+                        for (size_t k = 0; k < numTaps; k += 4)
+                        {
+                            sums[0] += taps[k] * x[k];
+                            sums[1] += taps[k + 1] * x[k + 1];
+                            sums[2] += taps[k + 2] * x[k + 2];
+                            sums[3] += taps[k + 3] * x[k + 3];
+                        }
+                        
+                        dest[m * inputLayout.sampleStride] = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+                    }
+                }
+            }));
+        }
+        
+        for (auto &worker : workers)
+            worker.join();
+        
+        hrir.swap(resampled);
+        fs = targetFs;
+        N = outputN;
+        paddedN = outputPaddedN;
+        
+        return true;
+    }
+    
+    
+    //  Modified Bessel function of the first kind, order 0, used by the Kaiser window
+    double BasicSOFA::besselI0(double x) const
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        
+        for (auto k = 1; k < 50; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            
+            if (term < sum * 1e-16)
+                break;
+        }
+        
+        return sum;
+    }
+    
+    
+    /*
+     *  Convert hrir into requestedFormat and release the full precision data
+     *  Int16 maps the peak of each IR to 32767, Float16 normalises each IR to a peak of 1 so small IRs do not end up as subnormals
+     *  When padding is selected, the 16 bit IRs are padded to compressedSIMDWidth so each one stays SOFA_IR_ALIGNMENT aligned
+     */
+    void BasicSOFA::encodeHRIRData()
+    {
+        auto sampleStride = getLayoutDescriptor().sampleStride;
+        auto compressedN = padIRs ? ((N + compressedSIMDWidth - 1) / compressedSIMDWidth) * compressedSIMDWidth : N;
+        
+        compressedHRIR = std::vector<uint16_t, SOFAAlignedAllocator<uint16_t>>(M * R * compressedN, 0);
+        irScales = std::vector<double>(M * R, 0.0);
+        
+        for (size_t irIndex = 0; irIndex < M; ++irIndex)
+        {
+            for (size_t channel = 0; channel < R; ++channel)
+            {
+                const double *src = hrir.data() + getIROffset(irIndex, channel);
+                uint16_t *dest = compressedHRIR.data() + (((irIndex * R) + channel) * compressedN);
+                
+                double peak = 0.0;
+                for (size_t n = 0; n < N; ++n)
+                    peak = std::max(peak, fabs(src[n * sampleStride]));
+                
+                if (peak == 0.0)
+                    continue;
+                
+                auto scale = requestedFormat == SOFASampleFormat::Int16 ? peak / 32767.0 : peak;
+                irScales[(irIndex * R) + channel] = scale;
+                
+                for (size_t n = 0; n < N; ++n)
+                {
+                    auto sample = src[n * sampleStride] / scale;
+                    
+                    if (requestedFormat == SOFASampleFormat::Int16)
+                        dest[n] = static_cast<uint16_t>(static_cast<int16_t>(lround(sample)));
+                    else
+                        dest[n] = floatToHalf(static_cast<float>(sample));
+                }
+            }
+        }
+        
+        hrir.erase(hrir.begin(), hrir.end());
+        hrir.shrink_to_fit();
+        
+        //  From here on, getIROffset() indexes compressedHRIR
+        paddedN = compressedN;
+        sampleFormat = requestedFormat;
+    }
+    
+    
+    /*
+     *  Write the N samples of an IR into dest, contiguously, whatever the sample format and layout
+     */
+    bool BasicSOFA::decodeHRIR(size_t irIndex, size_t channel, double *dest) const noexcept
+    {
+        auto offset = getIROffset(irIndex, channel);
+        
+        switch (sampleFormat)
+        {
+            case SOFASampleFormat::Double:
+            {
+                auto sampleStride = getLayoutDescriptor().sampleStride;
+                for (size_t n = 0; n < N; ++n)
+                    dest[n] = hrir[offset + (n * sampleStride)];
+                
+                return true;
+            }
+                
+            case SOFASampleFormat::Int16:
+                decodeInt16(compressedHRIR.data() + offset, irScales[(irIndex * R) + channel], dest, N);
+                return true;
+                
+            case SOFASampleFormat::Float16:
+                decodeFloat16(compressedHRIR.data() + offset, irScales[(irIndex * R) + channel], dest, N);
+                return true;
+        }
+        
+        return false;
+    }
+    
+    
+#if defined(SOFA_X86_DECODE_KERNELS)
+    //  Decode 8 samples at a time, returns the number of samples decoded
+    __attribute__((target("avx2")))
+    static size_t decodeInt16AVX2(const uint16_t *src, double scale, double *dest, size_t length) noexcept
+    {
+        size_t n = 0;
+        auto scales = _mm256_set1_pd(scale);
+        
+        for (; n + 8 <= length; n += 8)
+        {
+            auto samples = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n)));
+            _mm256_storeu_pd(dest + n, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(samples)), scales));
+            _mm256_storeu_pd(dest + n + 4, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(samples, 1)), scales));
+        }
+        
+        return n;
+    }
+    
+    
+    __attribute__((target("avx,f16c")))
+    static size_t decodeFloat16F16C(const uint16_t *src, double scale, double *dest, size_t length) noexcept
+    {
+        size_t n = 0;
+        auto scales = _mm256_set1_pd(scale);
+        
+        for (; n + 8 <= length; n += 8)
+        {
+            auto samples = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n)));
+            _mm256_storeu_pd(dest + n, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(samples)), scales));
+            _mm256_storeu_pd(dest + n + 4, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(samples, 1)), scales));
+        }
+        
+        return n;
+    }
+#endif
+    
+    
+    //  Uses the AVX2 kernel when the CPU supports it, the scalar loop handles the rest of the samples and other CPUs
+    void BasicSOFA::decodeInt16(const uint16_t *src, double scale, double *dest, size_t length) noexcept
+    {
+        size_t n = 0;
+        
+#if defined(SOFA_X86_DECODE_KERNELS)
+        static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+        if (hasAVX2)
+            n = decodeInt16AVX2(src, scale, dest, length);
+#endif
+        
+        for (; n < length; ++n)
+            dest[n] = scale * static_cast<int16_t>(src[n]);
+    }
+    
+    
+    //  Uses the F16C kernel when the CPU supports it, the scalar loop handles the rest of the samples and other CPUs
+    void BasicSOFA::decodeFloat16(const uint16_t *src, double scale, double *dest, size_t length) noexcept
+    {
+        size_t n = 0;
+        
+#if defined(SOFA_X86_DECODE_KERNELS)
+        static const bool hasF16C = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+        if (hasF16C)
+            n = decodeFloat16F16C(src, scale, dest, length);
+#endif
+        
+        for (; n < length; ++n)
+            dest[n] = scale * halfToFloat(src[n]);
+    }
+    
+    
+    //  IEEE 754 single to half precision conversion, rounding to nearest even
+    uint16_t BasicSOFA::floatToHalf(float value) noexcept
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        
+        uint32_t sign = (bits >> 16) & 0x8000;
+        int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffff;
+        
+        //  Infinity and NaN, and values too large for half precision
+        if (exponent >= 31)
+            return sign | 0x7c00 | ((bits & 0x7f800000) == 0x7f800000 && mantissa != 0 ? 0x200 : 0);
+        
+        //  Subnormal half precision values
+        if (exponent <= 0)
+        {
+            if (exponent < -10)
+                return sign;
+            
+            mantissa |= 0x800000;
+            uint32_t shift = 14 - exponent;
+            uint32_t half = mantissa >> shift;
+            uint32_t remainder = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            
+            if (remainder > halfway || (remainder == halfway && (half & 1)))
+                ++half;
+            
+            return sign | half;
+        }
+        
+        //  A carry out of the mantissa correctly bumps the exponent
+        uint32_t half = (exponent << 10) | (mantissa >> 13);
+        uint32_t remainder = mantissa & 0x1fff;
+        
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+            ++half;
+        
+        return sign | half;
+    }
+    
+    
+    float BasicSOFA::halfToFloat(uint16_t value) noexcept
+    {
+        uint32_t sign = (value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1f;
+        uint32_t mantissa = value & 0x3ff;
+        uint32_t bits;
+        
+        if (exponent == 0)
+        {
+            float magnitude = ldexpf(static_cast<float>(mantissa), -24);
+            return sign ? -magnitude : magnitude;
+        }
+        
+        if (exponent == 31)
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        else
+            bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+        
+        return result;
+    }
+    
+    
+    /*
+     *  Fit the decoder filters D(f) [(order + 1)^2 x 1] of each receiver so that Y x D(f) ~ H(f), where Y [Q x (order + 1)^2]
+     *  holds the spherical harmonics of the Q measured directions and H(f) the measured transfer functions
+     *
+     *  The regularised least squares solution is D(f) = (Y'Y + lambda I)^-1 Y' H(f).  The pseudo-inverse is frequency
+     *  independent so it is only computed once, through the normal equations.  Above the MagLS cutoff, the target is |H(f)| with
+     *  the phase of the previous bin's reconstruction, which keeps the fitted phase smooth across frequency
+     */
+    bool BasicSOFA::buildAmbisonicDecoder()
+    {
+        auto order = requestedAmbisonicOrder;
+        auto K = (order + 1) * (order + 1);
+        
+        //  Pick the radius to fit
+        const SOFACoordinateMap *coordinateMap = nullptr;
+        if (ambisonicRadius > 0)
+        {
+            auto radiusIt = radiusMap.find(round(ambisonicRadius));
+            if (radiusIt == radiusMap.end())
+                return false;
+            
+            coordinateMap = &coordinateMaps[radiusIt->second];
+        }
+        else
+        {
+            size_t mostDirections = 0;
+            for (const auto &map : coordinateMaps)
+            {
+                size_t numDirections = 0;
+                for (const auto &row : map.map)
+                    numDirections += row.size();
+                
+                if (numDirections > mostDirections)
+                {
+                    mostDirections = numDirections;
+                    coordinateMap = &map;
+                }
+            }
+        }
+        
+        if (coordinateMap == nullptr)
+            return false;
+        
+        //  Spherical harmonics of every measured direction
+        std::vector<size_t> irIndices;
+        std::vector<double> Y;
+        
+        for (const auto &phiIt : coordinateMap->phiMap)
+        {
+            for (const auto &thetaIt : coordinateMap->thetaMaps[phiIt.second])
+            {
+                irIndices.push_back(coordinateMap->map[phiIt.second][thetaIt.second]);
+                Y.resize(irIndices.size() * K);
+                getAmbisonicCoefficients(order, thetaIt.first, phiIt.first, Y.data() + ((irIndices.size() - 1) * K));
+            }
+        }
+        
+        auto Q = irIndices.size();
+        if (Q < K)
+        {
+            std::cout << "Not enough measured directions for an order " << order << " decoder" << std::endl;
+            return false;
+        }
+        
+        //  Gram matrix A = Y'Y + lambda I, factorised as L L'
+        std::vector<double> A(K * K, 0.0);
+        for (size_t q = 0; q < Q; ++q)
+            for (size_t i = 0; i < K; ++i)
+                for (size_t j = 0; j <= i; ++j)
+                    A[(i * K) + j] += Y[(q * K) + i] * Y[(q * K) + j];
+        
+        double trace = 0.0;
+        for (size_t i = 0; i < K; ++i)
+            trace += A[(i * K) + i];
+        
+        for (size_t i = 0; i < K; ++i)
+            A[(i * K) + i] += ambisonicRegularisation * trace / K;
+        
+        for (size_t j = 0; j < K; ++j)
+        {
+            for (size_t k = 0; k < j; ++k)
+                A[(j * K) + j] -= A[(j * K) + k] * A[(j * K) + k];
+            
+            if (A[(j * K) + j] <= 0.0)
+                return false;
+            
+            A[(j * K) + j] = sqrt(A[(j * K) + j]);
+            
+            for (auto i = j + 1; i < K; ++i)
+            {
+                for (size_t k = 0; k < j; ++k)
+                    A[(i * K) + j] -= A[(i * K) + k] * A[(j * K) + k];
+                
+                A[(i * K) + j] /= A[(j * K) + j];
+            }
+        }
+        
+        //  Pseudo-inverse P = A^-1 Y' [K x Q], one forward and one back substitution per direction
+        std::vector<double> pinv(K * Q);
+        std::vector<double> column(K);
+        
+        for (size_t q = 0; q < Q; ++q)
+        {
+            for (size_t i = 0; i < K; ++i)
+            {
+                column[i] = Y[(q * K) + i];
+                for (size_t k = 0; k < i; ++k)
+                    column[i] -= A[(i * K) + k] * column[k];
+                
+                column[i] /= A[(i * K) + i];
+            }
+            
+            for (int i = static_cast<int>(K) - 1; i >= 0; --i)
+            {
+                for (size_t k = i + 1; k < K; ++k)
+                    column[i] -= A[(k * K) + i] * column[k];
+                
+                column[i] /= A[(i * K) + i];
+            }
+            
+            for (size_t i = 0; i < K; ++i)
+                pinv[(i * Q) + q] = column[i];
+        }
+        
+        //  Transfer functions of every measured IR, [R x bins x Q]
+        size_t fftSize = 1;
+        while (fftSize < N)
+            fftSize <<= 1;
+        
+        auto numBins = (fftSize / 2) + 1;
+        std::vector<std::complex<double>> spectra(R * numBins * Q);
+        
+        auto numThreads = ambisonicThreads > 0 ? ambisonicThreads : std::max(1u, std::thread::hardware_concurrency());
+        auto runInParallel = [numThreads](size_t count, const std::function<void (size_t, size_t)> &task)
+        {
+            auto perThread = (count + numThreads - 1) / numThreads;
+            std::vector<std::thread> workers;
+            
+            for (size_t t = 0; t < numThreads; ++t)
+            {
+                auto first = t * perThread;
+                auto last = std::min(count, first + perThread);
+                if (first >= last)
+                    break;
+                
+                workers.push_back(std::thread(task, first, last));
+            }
+            
+            for (auto &worker : workers)
+                worker.join();
+        };
+        
+        runInParallel(Q * R, [&](size_t first, size_t last)
+        {
+            std::vector<double> ir(N);
+            std::vector<std::complex<double>> buffer(fftSize);
+            
+            for (auto index = first; index < last; ++index)
+            {
+                auto q = index / R;
+                auto channel = index % R;
+                decodeHRIR(irIndices[q], channel, ir.data());
+                
+                std::fill(buffer.begin(), buffer.end(), 0.0);
+                std::copy(ir.begin(), ir.end(), buffer.begin());
+                fft(buffer.data(), fftSize, false);
+                
+                for (size_t bin = 0; bin < numBins; ++bin)
+                    spectra[(((channel * numBins) + bin) * Q) + q] = buffer[bin];
+            }
+        });
+        
+        //  Fit every receiver and Ambisonic channel, [R x K x bins]
+        auto cutoff = magLSCutoff > 0 ? magLSCutoff : order * speedOfSound / (2.0 * M_PI * headRadius);
+        std::vector<std::complex<double>> decoder(R * K * numBins);
+        
+        runInParallel(R, [&](size_t first, size_t last)
+        {
+            std::vector<std::complex<double>> target(Q);
+            
+            for (auto channel = first; channel < last; ++channel)
+            {
+                const std::complex<double> *H = spectra.data() + (channel * numBins * Q);
+                std::complex<double> *D = decoder.data() + (channel * K * numBins);
+                
+                for (size_t bin = 0; bin < numBins; ++bin)
+                {
+                    const std::complex<double> *measured = H + (bin * Q);
+                    
+                    if (bin == 0 || (bin * fs / fftSize) < cutoff)
+                        std::copy(measured, measured + Q, target.begin());
+                    else
+                    {
+                        for (size_t q = 0; q < Q; ++q)
+                        {
+                            std::complex<double> previous = 0.0;
+                            for (size_t k = 0; k < K; ++k)
+                                previous += Y[(q * K) + k] * D[(k * numBins) + bin - 1];
+                            
+                            target[q] = std::polar(std::abs(measured[q]), std::arg(previous));
+                        }
+                    }
+                    
+                    for (size_t k = 0; k < K; ++k)
+                    {
+                        std::complex<double> sum = 0.0;
+                        for (size_t q = 0; q < Q; ++q)
+                            sum += pinv[(k * Q) + q] * target[q];
+                        
+                        //  DC and Nyquist must stay real for a real filter
+                        if (bin == 0 || bin == numBins - 1)
+                            sum = sum.real();
+                        
+                        D[(k * numBins) + bin] = sum;
+                    }
+                }
+            }
+        });
+        
+        spectra = std::vector<std::complex<double>>();
+        
+        //  Back to the time domain, and optionally to the spectra used for overlap-save convolution
+        ambisonicOrder = order;
+        ambisonicLength = fftSize;
+        ambisonicFilters = std::vector<double>(R * K * fftSize, 0.0);
+        
+        if (ambisonicSpectraEnabled)
+            ambisonicSpectra = std::vector<std::complex<double>>(R * K * (fftSize + 1));
+        
+        runInParallel(R * K, [&](size_t first, size_t last)
+        {
+            std::vector<std::complex<double>> buffer(2 * fftSize);
+            
+            for (auto filter = first; filter < last; ++filter)
+            {
+                const std::complex<double> *D = decoder.data() + (filter * numBins);
+                
+                for (size_t bin = 0; bin < numBins; ++bin)
+                    buffer[bin] = D[bin];
+                
+                for (auto bin = numBins; bin < fftSize; ++bin)
+                    buffer[bin] = std::conj(D[fftSize - bin]);
+                
+                fft(buffer.data(), fftSize, true);
+                
+                double *dest = ambisonicFilters.data() + (filter * fftSize);
+                for (size_t n = 0; n < fftSize; ++n)
+                    dest[n] = buffer[n].real() / fftSize;
+                
+                if (ambisonicSpectraEnabled)
+                {
+                    std::fill(buffer.begin(), buffer.end(), 0.0);
+                    std::copy(dest, dest + fftSize, buffer.begin());
+                    fft(buffer.data(), 2 * fftSize, false);
+                    std::copy(buffer.begin(), buffer.begin() + fftSize + 1, ambisonicSpectra.begin() + (filter * (fftSize + 1)));
+                }
+            }
+        });
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Fill the parametric table and the short IR tiers from the full precision IRs
+     *  The ITD is the lag of the peak of the interaural cross-correlation, refined with a parabolic fit around the peak
+     */
+    void BasicSOFA::buildLevelOfDetailTiers()
+    {
+        parametricTable = std::vector<SOFAParametricHRIR>(M, {0.0, 0.0, 0.0});
+        shortTiers.clear();
+        
+        for (auto length : requestedLODLengths)
+        {
+            length = std::min<size_t>(length, N);
+            if (length == 0 || std::find_if(shortTiers.begin(), shortTiers.end(), [length](const ShortHRIRTier &t) { return t.length == length; }) != shortTiers.end())
+                continue;
+            
+            shortTiers.push_back({length, std::vector<double>(M * R * length, 0.0), std::vector<size_t>(M * R, 0)});
+        }
+        
+        auto maxLag = std::min<long>(static_cast<long>(ceil(maxITD * fs)), static_cast<long>(N) - 1);
+        std::vector<double> irs(R * N);
+        std::vector<double> correlation((2 * maxLag) + 1);
+        std::vector<double> energies(R);
+        
+        for (size_t irIndex = 0; irIndex < M; ++irIndex)
+        {
+            double totalEnergy = 0.0;
+            
+            for (size_t channel = 0; channel < R; ++channel)
+            {
+                double *ir = irs.data() + (channel * N);
+                decodeHRIR(irIndex, channel, ir);
+                
+                energies[channel] = 0.0;
+                for (size_t n = 0; n < N; ++n)
+                    energies[channel] += ir[n] * ir[n];
+                
+                totalEnergy += energies[channel];
+                
+                //  Slide a window over the IR, keeping the one with the most energy
+                for (auto &tier : shortTiers)
+                {
+                    double windowEnergy = 0.0;
+                    for (size_t n = 0; n < tier.length; ++n)
+                        windowEnergy += ir[n] * ir[n];
+                    
+                    auto bestEnergy = windowEnergy;
+                    size_t bestStart = 0;
+                    
+                    for (auto start = 1; start + tier.length <= N; ++start)
+                    {
+                        windowEnergy += (ir[start + tier.length - 1] * ir[start + tier.length - 1]) - (ir[start - 1] * ir[start - 1]);
+                        if (windowEnergy > bestEnergy)
+                        {
+                            bestEnergy = windowEnergy;
+                            bestStart = start;
+                        }
+                    }
+                    
+                    tier.delays[(irIndex * R) + channel] = bestStart;
+                    std::copy(ir + bestStart, ir + bestStart + tier.length, tier.hrir.begin() + (((irIndex * R) + channel) * tier.length));
+                }
+            }
+            
+            auto &parameters = parametricTable[irIndex];
+            parameters.gain = sqrt(totalEnergy / (R * N));
+            
+            if (R != 2 || energies[0] == 0.0 || energies[1] == 0.0)
+                continue;
+            
+            parameters.ild = 10.0 * log10(energies[0] / energies[1]);
+            
+            const double *left = irs.data();
+            const double *right = irs.data() + N;
+            size_t peak = 0;
+            
+            for (long lag = -maxLag; lag <= maxLag; ++lag)
+            {
+                double sum = 0.0;
+                for (long n = std::max(0L, -lag); n < std::min<long>(N, N - lag); ++n)
+                    sum += left[n] * right[n + lag];
+                
+                correlation[lag + maxLag] = sum;
+                if (sum > correlation[peak])
+                    peak = lag + maxLag;
+            }
+            
+            double offset = 0.0;
+            if (peak > 0 && peak < correlation.size() - 1)
+            {
+                auto curvature = correlation[peak - 1] - (2.0 * correlation[peak]) + correlation[peak + 1];
+                if (curvature < 0.0)
+                    offset = 0.5 * (correlation[peak - 1] - correlation[peak + 1]) / curvature;
+            }
+            
+            parameters.itd = (static_cast<double>(peak) - maxLag + offset) / fs;
+        }
+    }
+    
+    
+    //  In place radix-2 FFT, size must be a power of two.  The inverse transform is not scaled
+    void BasicSOFA::fft(std::complex<double> *data, size_t size, bool inverse)
+    {
+        for (size_t i = 1, j = 0; i < size; ++i)
+        {
+            auto bit = size >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i], data[j]);
+        }
+        
+        for (size_t length = 2; length <= size; length <<= 1)
+        {
+            auto angle = (inverse ? 2.0 : -2.0) * M_PI / length;
+            std::complex<double> step(cos(angle), sin(angle));
+            
+            for (size_t start = 0; start < size; start += length)
+            {
+                std::complex<double> twiddle = 1.0;
+                for (size_t k = 0; k < length / 2; ++k)
+                {
+                    auto even = data[start + k];
+                    auto odd = data[start + k + (length / 2)] * twiddle;
+                    
+                    data[start + k] = even + odd;
+                    data[start + k + (length / 2)] = even - odd;
+                    twiddle *= step;
+                }
+            }
+        }
+    }
 }
 
 
@@ -10,9 +10,12 @@
 #define BasicSOFA_
 
 #include <H5Cpp.h>
+#include <complex>
 #include <vector>
 #include <unordered_map>
+#include <new>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define SOFA_STANDARD_STRING    "AES69-2015"
 #define SUPPORTED_VERSION       "1.0"
@@ -27,6 +30,8 @@
 #define SOFA_SRC_POS_STRING     "SourcePosition"
 #define SOFA_LIS_POS_STRING     "ListenerPosition"
 
+#define SOFA_IR_ALIGNMENT       64      //  Byte alignment of the IR storage, wide enough for AVX-512 loads
+
 
 
 /* The classes below are exported */
@@ -35,6 +40,80 @@
 namespace BasicSOFA
 {
     
+    /*
+     *  STL allocator returning memory aligned to SOFA_IR_ALIGNMENT bytes
+     *  IR storage uses this so that the start of every IR (or every direction block) can be fed to aligned SIMD loads
+     */
+    template <typename T>
+    struct SOFAAlignedAllocator
+    {
+        typedef T value_type;
+        
+        SOFAAlignedAllocator () noexcept {}
+        template <typename U> SOFAAlignedAllocator (const SOFAAlignedAllocator<U> &) noexcept {}
+        
+        T* allocate (size_t n)
+        {
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, SOFA_IR_ALIGNMENT, n * sizeof(T)) != 0)
+                throw std::bad_alloc();
+            
+            return static_cast<T*>(ptr);
+        }
+        
+        void deallocate (T *ptr, size_t) noexcept { free(ptr); }
+    };
+    
+    template <typename T, typename U>
+    bool operator== (const SOFAAlignedAllocator<T> &, const SOFAAlignedAllocator<U> &) { return true; }
+    
+    template <typename T, typename U>
+    bool operator!= (const SOFAAlignedAllocator<T> &, const SOFAAlignedAllocator<U> &) { return false; }
+    
+    
+    enum class SOFAIRLayout
+    {
+        Contiguous,     //  [M x R x N]  Each receiver's IR is stored contiguously (SOFA file order)
+        Interleaved     //  [M x N x R]  Receiver samples are interleaved ie. L/R sample pairs for stereo sets
+    };
+    
+    
+    enum class SOFASampleFormat
+    {
+        Double,         //  Full precision, IRs can be read in place through getHRIR()
+        Float16,        //  IEEE half precision, each IR normalised by its peak
+        Int16           //  16 bit fixed point, each IR scaled so that its peak maps to full scale
+    };
+    
+    
+    /*
+     *  Describes how the IRs are laid out in memory
+     *  All strides and lengths are given in samples, not bytes
+     */
+    struct SOFALayoutDescriptor
+    {
+        SOFAIRLayout    layout;
+        size_t          alignment;          //  Byte alignment of the start of every IR, or every block with the interleaved layout
+        size_t          length;             //  Number of valid samples per IR ie. N
+        size_t          paddedLength;       //  Number of samples per IR including the zero padding at the end
+        size_t          padding;            //  paddedLength - length
+        size_t          sampleStride;       //  Distance between consecutive samples of the same receiver
+        size_t          receiverStride;     //  Distance between the first samples of consecutive receivers
+        size_t          measurementStride;  //  Distance between the first samples of consecutive measurements
+    };
+    
+    
+    /*
+     *  Parametric description of a direction for cheap panning of distant or low priority sources
+     */
+    struct SOFAParametricHRIR
+    {
+        double          itd;        //  Interaural time difference in seconds, positive when the right ear lags ie. sources on the left
+        double          ild;        //  Interaural level difference in dB, left over right
+        double          gain;       //  Broadband RMS gain over every receiver
+    };
+    
+    
     struct SOFACoordinateMap
     {
         double                                          radius;
@@ -55,6 +134,39 @@ namespace BasicSOFA
                         BasicSOFA();
         bool            readSOFAFile (std::string filePath);
         const double*   getHRIR (size_t channel, double theta, double phi, double radius) const noexcept;
+        const double*   getHRIRBlock (double theta, double phi, double radius) const noexcept;
+        bool            copyHRIR (size_t channel, double theta, double phi, double radius, double *dest) const noexcept;
+        
+        void            setIRLayout (SOFAIRLayout layout, bool padToSIMDWidth = false);
+        SOFALayoutDescriptor getLayoutDescriptor () const;
+        
+        void            setDirectChunkRead (bool enable, unsigned int numThreads = 0);
+        bool            isDirectChunkReadUsed () const { return directChunkReadUsed; }
+        
+        void            setTargetSampleRate (double targetFs, unsigned int numThreads = 0);
+        
+        void            setSampleFormat (SOFASampleFormat format);
+        SOFASampleFormat getSampleFormat () const { return sampleFormat; }
+        
+        void            setDistanceModel (bool enable, double referenceRadius = 0, double headRadius = 0.0875);
+        bool            getDistanceModelledHRIR (size_t channel, double theta, double phi, double distance, double *dest, bool applyDelay = true) const noexcept;
+        double          getDistanceDelay (double distance) const;
+        bool            isDistanceModelEnabled () const { return distanceModelEnabled; }
+        double          getReferenceRadius () const { return referenceRadius; }
+        
+        void            setAmbisonicDecoder (bool enable, unsigned int order = 1, double radius = 0, bool frequencyDomain = false, double magLSCutoff = 0, unsigned int numThreads = 0);
+        const double*   getAmbisonicFilter (size_t channel, size_t acn) const noexcept;
+        const std::complex<double>* getAmbisonicSpectrum (size_t channel, size_t acn) const noexcept;
+        size_t          getAmbisonicOrder () const { return ambisonicOrder; }
+        size_t          getNumAmbisonicChannels () const { return ambisonicFilters.size() == 0 ? 0 : (ambisonicOrder + 1) * (ambisonicOrder + 1); }
+        size_t          getAmbisonicFilterLength () const { return ambisonicLength; }
+        size_t          getAmbisonicSpectrumSize () const { return ambisonicSpectra.size() == 0 ? 0 : ambisonicLength + 1; }
+        static void     getAmbisonicCoefficients (unsigned int order, double theta, double phi, double *coefficients);
+        
+        void            setLevelOfDetail (bool enable, const std::vector<size_t> &shortLengths = {32, 64});
+        bool            getParametricHRIR (double theta, double phi, double radius, SOFAParametricHRIR &parameters) const noexcept;
+        const double*   getShortHRIR (size_t channel, double theta, double phi, double radius, size_t length, size_t &delay) const noexcept;
+        std::vector<size_t> getShortHRIRLengths () const;
         
         double          getFs () const { return fs; }
         double          getM () const { return M; }
@@ -73,6 +185,7 @@ namespace BasicSOFA
         double          getDeltaTheta () const { return dTheta; }
         
         size_t          getMinImpulseDelay () const { return minImpulseDelay; }
+        size_t          getMemoryUsage () const;
         
         void            resetSOFAData ();
         
@@ -80,6 +193,16 @@ namespace BasicSOFA
         
     protected:
         
+        //  Storage format of a chunked Data.IR dataset and where its rows go in hrir, used by the direct chunk reader
+        struct HRIRChunkFormat
+        {
+            hsize_t                     dims[3];
+            hsize_t                     extents[3];
+            size_t                      elementSize;
+            std::vector<H5Z_filter_t>   filters;        //  In the order they were applied when writing
+            std::vector<size_t>         rowToIndex;     //  Measurement index of each file row, SIZE_MAX if the row is not loaded
+        };
+        
         double                  round (const double &x) const;
         void                    addValueToArray (const double &x, std::vector<double> &A);
         bool                    calculateCoordinateStatisticalData ();
@@ -87,6 +210,27 @@ namespace BasicSOFA
         bool                    buildCoordinateMap (const std::vector<double> &coordinates);
         hsize_t                 getSOFASingleDimParameterSize(std::string parameter);
         bool                    findMinImpulseDelay();
+        bool                    readHRIRData (H5::DataSet &dataSet);
+        bool                    getHRIRChunkFormat (H5::DataSet &dataSet, HRIRChunkFormat &format);
+        bool                    readHRIRChunks (H5::DataSet &dataSet, const HRIRChunkFormat &format);
+        bool                    decodeHRIRChunk (const std::vector<unsigned char> &chunk, uint32_t filterMask, const hsize_t *chunkOffset, const HRIRChunkFormat &format);
+        bool                    findIRIndex (double theta, double phi, double radius, size_t &irIndex) const noexcept;
+        size_t                  getIROffset (size_t irIndex, size_t channel) const noexcept;
+        size_t                  getFileRow (size_t irIndex) const noexcept;
+        bool                    selectReferenceRadius (std::vector<double> &coordinates);
+        void                    buildNearFieldFilterBank ();
+        void                    getSphericalHeadMagnitudes (double distance, double frequency, std::vector<double> &magnitudes) const;
+        bool                    resampleHRIRData ();
+        void                    encodeHRIRData ();
+        bool                    decodeHRIR (size_t irIndex, size_t channel, double *dest) const noexcept;
+        static void             decodeInt16 (const uint16_t *src, double scale, double *dest, size_t length) noexcept;
+        static void             decodeFloat16 (const uint16_t *src, double scale, double *dest, size_t length) noexcept;
+        static uint16_t         floatToHalf (float value) noexcept;
+        static float            halfToFloat (uint16_t value) noexcept;
+        double                  besselI0 (double x) const;
+        bool                    buildAmbisonicDecoder ();
+        void                    buildLevelOfDetailTiers ();
+        static void             fft (std::complex<double> *data, size_t size, bool inverse);
         
         
         H5::H5File  h5File;
@@ -116,11 +260,78 @@ namespace BasicSOFA
         std::vector<double>                 phiList;
         std::vector<double>                 radiusList;
         
-        std::vector<double>                 hrir;
+        std::vector<double, SOFAAlignedAllocator<double>>   hrir;
+        std::vector<uint16_t, SOFAAlignedAllocator<uint16_t>> compressedHRIR;   //  Used instead of hrir by the 16 bit sample formats
+        std::vector<double>                 irScales;           //  Scale factor of each compressed IR, [M x R]
+        SOFASampleFormat                    sampleFormat;       //  Format of the loaded IRs
+        SOFASampleFormat                    requestedFormat;    //  Format used by the next readSOFAFile()
+        SOFAIRLayout                        irLayout;           //  Layout of the loaded IRs
+        bool                                padIRs;
+        SOFAIRLayout                        requestedLayout;    //  Layout used by the next readSOFAFile()
+        bool                                requestedPadding;
+        size_t                              paddedN;
+        bool                                directChunkRead;
+        bool                                directChunkReadUsed;    //  Whether the loaded IRs were decoded by the direct chunk reader
+        unsigned int                        loaderThreads;
+        std::vector<hsize_t>                measurementRows;    //  File row of each loaded measurement, empty if every row is loaded
+        double                              targetFs;           //  Sampling rate the IRs are converted to at load, 0 to keep the file rate
+        unsigned int                        resamplerThreads;
+        
+        //  Near-field distance model
+        bool                                distanceModelEnabled;
+        double                              requestedReferenceRadius;
+        double                              referenceRadius;
+        double                              headRadius;
+        std::vector<double>                 nearFieldDistances;
+        std::vector<double>                 nearFieldFilters;   //  [angle x distance x (nearFieldHalfLength + 1)], one half of each zero phase filter
+        
+        //  Binaural Ambisonic decoder
+        bool                                ambisonicDecoderEnabled;
+        unsigned int                        requestedAmbisonicOrder;
+        double                              ambisonicRadius;    //  Radius of the directions used in the fit, 0 for the radius with the most directions
+        bool                                ambisonicSpectraEnabled;
+        double                              magLSCutoff;        //  Frequency above which only the magnitude is fitted, 0 to derive it from the order
+        unsigned int                        ambisonicThreads;
+        size_t                              ambisonicOrder;     //  Order of the loaded decoder
+        size_t                              ambisonicLength;
+        std::vector<double>                 ambisonicFilters;   //  [R x (order + 1)^2 x ambisonicLength]
+        std::vector<std::complex<double>>   ambisonicSpectra;   //  [R x (order + 1)^2 x (ambisonicLength + 1)], FFT of each filter zero padded to twice its length
+        
+        //  Level of detail tiers
+        struct ShortHRIRTier
+        {
+            size_t                          length;
+            std::vector<double>             hrir;               //  [M x R x length]
+            std::vector<size_t>             delays;             //  [M x R], offset of each short IR within the full IR
+        };
+        
+        bool                                lodEnabled;
+        std::vector<size_t>                 requestedLODLengths;
+        std::vector<SOFAParametricHRIR>     parametricTable;    //  [M]
+        std::vector<ShortHRIRTier>          shortTiers;
+        
         std::vector<SOFACoordinateMap>      coordinateMaps;
         std::unordered_map<double, size_t>  radiusMap;
         
         static constexpr double             epsilon = 0.1;
+        static constexpr size_t             simdWidth = SOFA_IR_ALIGNMENT / sizeof(double);
+        static constexpr size_t             compressedSIMDWidth = SOFA_IR_ALIGNMENT / sizeof(uint16_t);
+        static constexpr size_t             readBatchSize = 1 << 20;    //  Bytes of scratch used when repacking HRIR data at load
+        static constexpr size_t             chunksPerThread = 16;       //  Raw chunks held in memory per loader thread
+        
+        static constexpr double             speedOfSound = 343.0;
+        static constexpr double             nearFieldAngleStep = 5.0;   //  Degrees between the incidence angles of the filter bank
+        static constexpr size_t             nearFieldNumDistances = 32;
+        static constexpr size_t             nearFieldHalfLength = 48;   //  Each filter has 2 * nearFieldHalfLength + 1 taps
+        static constexpr size_t             nearFieldDesignSize = 512;  //  Number of frequency points used to design the filters
+        
+        static constexpr double             resamplerZeroCrossings = 16;    //  Zero crossings of the interpolating sinc on each side
+        static constexpr double             resamplerRolloff = 0.95;        //  Cutoff as a fraction of the lower Nyquist frequency
+        static constexpr double             resamplerKaiserBeta = 8.0;
+        static constexpr size_t             maxResamplerPhases = 4096;
+        
+        static constexpr double             maxITD = 0.001;     //  Largest lag in seconds searched when estimating the ITD
+        static constexpr double             ambisonicRegularisation = 1e-4;     //  Tikhonov weight relative to the mean eigenvalue of the spherical harmonic Gram matrix
         
         bool                                dataLoaded;
     };
@@ -0,0 +1,303 @@
+//
+//  SOFACatalog.cpp
+//  BasicSOFA
+//
+//  Copyright © 2020 meoWorkshop. All rights reserved.
+//
+
+#include "SOFACatalog.hpp"
+
+namespace BasicSOFA
+{
+    SOFACatalog::SOFACatalog(size_t memoryBudget)
+    {
+        this->memoryBudget = memoryBudget;
+        memoryUsage = 0;
+        accessCounter = 0;
+    }
+    
+    
+    /*
+     *  Register a dataset without loading it
+     *  configure is called on a fresh BasicSOFA object before every load, eg. to select a layout or a target sampling rate
+     */
+    bool SOFACatalog::addDataset(const std::string &id, const std::string &path, Configurator configure)
+    {
+        if (id == "" || path == "")
+            return false;
+        
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        
+        if (datasets.find(id) != datasets.end())
+            return false;
+        
+        DatasetEntry entry;
+        entry.path = path;
+        entry.configure = configure;
+        entry.loading = false;
+        entry.pinCount = 0;
+        entry.bytes = 0;
+        entry.loadedBytes = 0;
+        entry.lastUsed = 0;
+        
+        datasets.insert({id, entry});
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Unregister a dataset, waiting for it to finish loading if needed
+     *  Holders of the dataset keep it alive, but it no longer counts against the budget
+     */
+    bool SOFACatalog::removeDataset(const std::string &id)
+    {
+        std::unique_lock<std::mutex> lock(catalogMutex);
+        
+        auto it = datasets.find(id);
+        while (it != datasets.end() && it->second.loading)
+        {
+            loadFinished.wait(lock);
+            it = datasets.find(id);
+        }
+        
+        if (it == datasets.end())
+            return false;
+        
+        memoryUsage -= it->second.bytes;
+        datasets.erase(it);
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Get a dataset, loading it first if it is not resident
+     *  An evicted dataset that is still held elsewhere is made resident again without reloading it
+     *  The file is read without holding the catalog lock so other datasets can be acquired in the meantime
+     *  If the dataset was loaded before, room is made for it before the file is read so the budget is not overshot during the load
+     *  Returns nullptr if the ID is unknown or the file could not be read
+     */
+    std::shared_ptr<const BasicSOFA> SOFACatalog::acquire(const std::string &id)
+    {
+        std::string path;
+        Configurator configure;
+        
+        {
+            std::unique_lock<std::mutex> lock(catalogMutex);
+            
+            auto it = datasets.find(id);
+            while (it != datasets.end() && it->second.loading)
+            {
+                loadFinished.wait(lock);
+                it = datasets.find(id);
+            }
+            
+            if (it == datasets.end())
+                return nullptr;
+            
+            auto &entry = it->second;
+            entry.lastUsed = ++accessCounter;
+            
+            if (entry.data != nullptr)
+                return entry.data;
+            
+            //  Its bytes were never released, so reviving it does not change the memory usage
+            entry.data = entry.evicted.lock();
+            entry.evicted.reset();
+            if (entry.data != nullptr)
+                return entry.data;
+            
+            entry.loading = true;
+            path = entry.path;
+            configure = entry.configure;
+            
+            evictToBudget(entry.loadedBytes);
+        }
+        
+        auto sofa = std::make_shared<BasicSOFA>();
+        if (configure != nullptr)
+            configure(*sofa);
+        
+        bool success = sofa->readSOFAFile(path);
+        
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        
+        //  removeDataset() waits for the load, so the entry is still there
+        auto &entry = datasets.at(id);
+        entry.loading = false;
+        loadFinished.notify_all();
+        
+        if (!success)
+            return nullptr;
+        
+        entry.data = sofa;
+        entry.bytes = sofa->getMemoryUsage();
+        entry.loadedBytes = entry.bytes;
+        entry.lastUsed = ++accessCounter;
+        memoryUsage += entry.bytes;
+        
+        evictToBudget();
+        
+        return sofa;
+    }
+    
+    
+    /*
+     *  Get a dataset by file path, registering it with the path as its ID if needed
+     */
+    std::shared_ptr<const BasicSOFA> SOFACatalog::openFile(const std::string &path)
+    {
+        addDataset(path, path);
+        
+        return acquire(path);
+    }
+    
+    
+    /*
+     *  Load a dataset if needed and keep it resident until every pin() is matched by an unpin()
+     */
+    bool SOFACatalog::pin(const std::string &id)
+    {
+        {
+            std::lock_guard<std::mutex> lock(catalogMutex);
+            
+            auto it = datasets.find(id);
+            if (it == datasets.end())
+                return false;
+            
+            it->second.pinCount++;
+        }
+        
+        //  The pin is taken before loading so the dataset cannot be evicted right after it is loaded
+        if (acquire(id) == nullptr)
+        {
+            unpin(id);
+            return false;
+        }
+        
+        return true;
+    }
+    
+    
+    bool SOFACatalog::unpin(const std::string &id)
+    {
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        
+        auto it = datasets.find(id);
+        if (it == datasets.end() || it->second.pinCount == 0)
+            return false;
+        
+        it->second.pinCount--;
+        evictToBudget();
+        
+        return true;
+    }
+    
+    
+    void SOFACatalog::setMemoryBudget(size_t memoryBudget)
+    {
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        
+        this->memoryBudget = memoryBudget;
+        evictToBudget();
+    }
+    
+    
+    size_t SOFACatalog::getMemoryBudget() const
+    {
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        return memoryBudget;
+    }
+    
+    
+    /*
+     *  Memory held by every resident dataset and every evicted dataset still held by a caller
+     */
+    size_t SOFACatalog::getMemoryUsage() const
+    {
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        
+        size_t usage = 0;
+        for (const auto &dataset : datasets)
+        {
+            const auto &entry = dataset.second;
+            if (entry.data != nullptr || !entry.evicted.expired())
+                usage += entry.bytes;
+        }
+        
+        return usage;
+    }
+    
+    
+    std::vector<SOFADatasetResidency> SOFACatalog::getResidency() const
+    {
+        std::lock_guard<std::mutex> lock(catalogMutex);
+        std::vector<SOFADatasetResidency> residency;
+        
+        for (const auto &dataset : datasets)
+        {
+            const auto &entry = dataset.second;
+            auto held = entry.data == nullptr && !entry.evicted.expired();
+            auto bytes = (entry.data != nullptr || held) ? entry.bytes : 0;
+            
+            residency.push_back({dataset.first, entry.path, entry.data != nullptr, held, entry.pinCount, bytes, entry.lastUsed});
+        }
+        
+        return residency;
+    }
+    
+    
+    /*
+     *  Evict the least recently used unpinned datasets until the memory usage plus reserve fits in the budget
+     *  Evicting a dataset that is still held elsewhere does not free anything until it is let go, so more datasets may be evicted
+     *  If only pinned or held datasets are left, the catalog stays over budget
+     *  Must be called with catalogMutex held
+     */
+    void SOFACatalog::evictToBudget(size_t reserve)
+    {
+        updateMemoryUsage();
+        
+        while (memoryUsage + reserve > memoryBudget)
+        {
+            DatasetEntry *victim = nullptr;
+            
+            for (auto &dataset : datasets)
+            {
+                auto &entry = dataset.second;
+                if (entry.data == nullptr || entry.pinCount > 0)
+                    continue;
+                
+                if (victim == nullptr || entry.lastUsed < victim->lastUsed)
+                    victim = &entry;
+            }
+            
+            if (victim == nullptr)
+                return;
+            
+            victim->evicted = victim->data;
+            victim->data.reset();
+            
+            updateMemoryUsage();
+        }
+    }
+    
+    
+    /*
+     *  Release the bytes of evicted datasets that nobody holds any more
+     *  Must be called with catalogMutex held
+     */
+    void SOFACatalog::updateMemoryUsage()
+    {
+        for (auto &dataset : datasets)
+        {
+            auto &entry = dataset.second;
+            if (entry.data == nullptr && entry.bytes > 0 && entry.evicted.expired())
+            {
+                memoryUsage -= entry.bytes;
+                entry.bytes = 0;
+                entry.evicted.reset();
+            }
+        }
+    }
+}
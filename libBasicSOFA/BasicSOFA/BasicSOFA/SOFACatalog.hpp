@@ -0,0 +1,103 @@
+//
+//  SOFACatalog.hpp
+//  BasicSOFA
+//
+//  Copyright © 2020 meoWorkshop. All rights reserved.
+//
+
+#ifndef SOFACatalog_
+#define SOFACatalog_
+
+#include "BasicSOFA.hpp"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace BasicSOFA
+{
+
+    struct SOFADatasetResidency
+    {
+        std::string     id;
+        std::string     path;
+        bool            loaded;
+        bool            heldAfterEviction;  //  Evicted but still held by a caller, so it still counts against the budget
+        size_t          pinCount;
+        size_t          bytes;          //  Memory held by the dataset while it is alive, 0 once it has been released
+        uint64_t        lastUsed;       //  Catalog access counter value at the last acquire(), larger is more recent
+    };
+
+
+    /*
+     *  Hosts many SOFA datasets under a single memory budget
+     *
+     *  Datasets are registered by ID and loaded on demand by acquire()
+     *  Whenever the memory held by all loaded datasets goes over the budget, the least recently used datasets are evicted
+     *  Pinned datasets (eg. the profiles of active listeners) are kept loaded and are never evicted
+     *
+     *  acquire() hands out shared pointers, so an evicted dataset stays valid for whoever still holds it
+     *  It keeps counting against the budget until the last holder lets go, and acquiring it again in the meantime
+     *  hands out the same object rather than loading a second copy
+     *  Concurrent acquires of a dataset being loaded wait for that load instead of reading the file again
+     */
+    class SOFACatalog
+    {
+    public:
+    
+        typedef std::function<void (BasicSOFA &)> Configurator;
+        
+                        SOFACatalog (size_t memoryBudget);
+        
+        bool            addDataset (const std::string &id, const std::string &path, Configurator configure = nullptr);
+        bool            removeDataset (const std::string &id);
+        
+        std::shared_ptr<const BasicSOFA>    acquire (const std::string &id);
+        std::shared_ptr<const BasicSOFA>    openFile (const std::string &path);
+        
+        bool            pin (const std::string &id);
+        bool            unpin (const std::string &id);
+        
+        void            setMemoryBudget (size_t memoryBudget);
+        size_t          getMemoryBudget () const;
+        size_t          getMemoryUsage () const;
+        
+        std::vector<SOFADatasetResidency>   getResidency () const;
+
+
+
+    protected:
+    
+        struct DatasetEntry
+        {
+            std::string                         path;
+            Configurator                        configure;
+            std::shared_ptr<const BasicSOFA>    data;
+            std::weak_ptr<const BasicSOFA>      evicted;        //  Set after eviction until the last holder lets go
+            bool                                loading;
+            size_t                              pinCount;
+            size_t                              bytes;
+            size_t                              loadedBytes;    //  Size of the last load, used to make room before loading again
+            uint64_t                            lastUsed;
+        };
+        
+        void                    evictToBudget (size_t reserve = 0);
+        void                    updateMemoryUsage ();
+
+
+        std::unordered_map<std::string, DatasetEntry>   datasets;
+        size_t                                          memoryBudget;
+        size_t                                          memoryUsage;
+        uint64_t                                        accessCounter;
+        mutable std::mutex                              catalogMutex;
+        std::condition_variable                         loadFinished;
+    };
+}
+
+#pragma GCC visibility pop
+#endif
@@ -0,0 +1,270 @@
+//
+//  SOFAHRIRCache.cpp
+//  BasicSOFA
+//
+//  Copyright © 2020 meoWorkshop. All rights reserved.
+//
+
+#include "SOFAHRIRCache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace BasicSOFA
+{
+    static std::atomic<uint64_t> nextCacheId(1);
+    
+    
+    SOFAHRIRCache::SOFAHRIRCache(const BasicSOFA &sofa, size_t capacity, double angleResolution, double radiusResolution) : sofa(sofa)
+    {
+        cacheId = nextCacheId++;
+        this->angleResolution = angleResolution > 0 ? angleResolution : 0.1;
+        this->radiusResolution = radiusResolution > 0 ? radiusResolution : 0.01;
+        
+        for (size_t i = 0; i < std::max<size_t>(capacity, 1); ++i)
+        {
+            auto slot = std::unique_ptr<CacheSlot>(new CacheSlot);
+            slot->occupied = false;
+            slot->sequence = 0;
+            slot->referenced = false;
+            slot->hrir = std::vector<double>(sofa.getN());
+            
+            slots.push_back(std::move(slot));
+        }
+        
+        slotLength = sofa.getN();
+        clockHand = 0;
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+    }
+    
+    
+    /*
+     *  Copy the IR for the quantised direction into dest, which must hold at least getN() samples
+     *  On a miss, the IR is produced according to mode and stored in the cache
+     *  Returns false if the IR could not be produced, eg. the direction is not in the loaded data
+     *
+     *  The cache may be built before the BasicSOFA object is loaded.  If N has changed since the slots were sized (eg. the object was
+     *  reloaded with another target sampling rate) the slots are resized and emptied on the next miss.  Reloading the object must not
+     *  overlap with queries, and the cache should be cleared after a reload with the same N
+     */
+    bool SOFAHRIRCache::getHRIR(size_t channel, double theta, double phi, double radius, double *dest, SOFAQueryMode mode)
+    {
+        size_t length = sofa.getN();
+        if (dest == nullptr || length == 0)
+            return false;
+        
+        auto key = quantise(channel, theta, phi, radius, mode);
+        auto &frontEntry = getFrontEnd().entries[CacheKeyHash()(key) % 64];
+        
+        //  Lock free path: copy the slot and make sure it was not rewritten while copying
+        if (frontEntry.valid && frontEntry.key == key && slotLength.load(std::memory_order_acquire) == length)
+        {
+            auto &slot = *slots[frontEntry.slot];
+            
+            if (slot.sequence.load(std::memory_order_acquire) == frontEntry.sequence)
+            {
+                memcpy(dest, slot.hrir.data(), length * sizeof(double));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                
+                if (slot.sequence.load(std::memory_order_relaxed) == frontEntry.sequence)
+                {
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        
+        std::lock_guard<std::mutex> lock(indexMutex);
+        
+        if (slotLength.load(std::memory_order_relaxed) != length)
+            resetSlots(length);
+        
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            auto &slot = *slots[it->second];
+            memcpy(dest, slot.hrir.data(), length * sizeof(double));
+            slot.referenced.store(true, std::memory_order_relaxed);
+            
+            frontEntry = {key, it->second, slot.sequence.load(std::memory_order_relaxed), true};
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        
+        misses.fetch_add(1, std::memory_order_relaxed);
+        
+        if (!evaluate(key, dest))
+            return false;
+        
+        auto slotIndex = evictSlot();
+        auto &slot = *slots[slotIndex];
+        
+        slot.sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(slot.hrir.data(), dest, length * sizeof(double));
+        slot.sequence.fetch_add(1, std::memory_order_release);
+        
+        slot.key = key;
+        slot.occupied = true;
+        slot.referenced.store(true, std::memory_order_relaxed);
+        index.insert({key, slotIndex});
+        
+        frontEntry = {key, slotIndex, slot.sequence.load(std::memory_order_relaxed), true};
+        
+        return true;
+    }
+    
+    
+    /*
+     *  Drop every cached IR
+     *  Bumping the sequence counters invalidates the front-end entries held by other threads
+     */
+    void SOFAHRIRCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        resetSlots(slotLength.load(std::memory_order_relaxed));
+    }
+    
+    
+    SOFACacheStatistics SOFAHRIRCache::getStatistics() const
+    {
+        SOFACacheStatistics statistics;
+        
+        statistics.hits = hits.load(std::memory_order_relaxed);
+        statistics.misses = misses.load(std::memory_order_relaxed);
+        statistics.evictions = evictions.load(std::memory_order_relaxed);
+        
+        return statistics;
+    }
+    
+    
+    void SOFAHRIRCache::resetStatistics()
+    {
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+    }
+    
+    
+    size_t SOFAHRIRCache::CacheKeyHash::operator() (const CacheKey &key) const
+    {
+        uint64_t hash = 1469598103934665603ull;
+        const uint64_t values[4] = {static_cast<uint64_t>(key.theta), static_cast<uint64_t>(key.phi), static_cast<uint64_t>(key.radius), (static_cast<uint64_t>(key.channel) << 32) | key.mode};
+        
+        for (auto value : values)
+        {
+            hash ^= value;
+            hash *= 1099511628211ull;
+            hash ^= hash >> 29;
+        }
+        
+        return static_cast<size_t>(hash);
+    }
+    
+    
+    SOFAHRIRCache::CacheKey SOFAHRIRCache::quantise(size_t channel, double theta, double phi, double radius, SOFAQueryMode mode) const
+    {
+        CacheKey key;
+        
+        key.theta = std::llround(theta / angleResolution);
+        key.phi = std::llround(phi / angleResolution);
+        key.radius = std::llround(radius / radiusResolution);
+        key.channel = static_cast<uint32_t>(channel);
+        key.mode = static_cast<uint32_t>(mode);
+        
+        return key;
+    }
+    
+    
+    /*
+     *  Produce the IR for a key at the centre of its quantisation cell
+     */
+    bool SOFAHRIRCache::evaluate(const CacheKey &key, double *dest) const
+    {
+        auto theta = key.theta * angleResolution;
+        auto phi = key.phi * angleResolution;
+        auto radius = key.radius * radiusResolution;
+        
+        switch (static_cast<SOFAQueryMode>(key.mode))
+        {
+            case SOFAQueryMode::Measured:
+                return sofa.copyHRIR(key.channel, theta, phi, radius, dest);
+                
+            case SOFAQueryMode::DistanceModel:
+                return sofa.getDistanceModelledHRIR(key.channel, theta, phi, radius, dest);
+        }
+        
+        return false;
+    }
+    
+    
+    /*
+     *  Each thread has one front-end table, tagged with the id of the cache it belongs to
+     *  Switching caches on the same thread resets the table
+     */
+    SOFAHRIRCache::FrontEnd& SOFAHRIRCache::getFrontEnd() const
+    {
+        thread_local FrontEnd frontEnd = {0, {}};
+        
+        if (frontEnd.cacheId != cacheId)
+        {
+            frontEnd.cacheId = cacheId;
+            for (auto &entry : frontEnd.entries)
+                entry.valid = false;
+        }
+        
+        return frontEnd;
+    }
+    
+    
+    /*
+     *  Empty every slot and size it for IRs of the given length
+     *  Must be called with indexMutex held
+     */
+    void SOFAHRIRCache::resetSlots(size_t length)
+    {
+        for (auto &slot : slots)
+        {
+            slot->sequence.fetch_add(2, std::memory_order_release);
+            slot->occupied = false;
+            slot->referenced = false;
+            
+            if (slot->hrir.size() != length)
+                slot->hrir = std::vector<double>(length);
+        }
+        
+        index.clear();
+        clockHand = 0;
+        slotLength.store(length, std::memory_order_release);
+    }
+    
+    
+    /*
+     *  CLOCK eviction: sweep the slots, clearing reference bits, until an unreferenced slot is found
+     *  Must be called with indexMutex held
+     */
+    size_t SOFAHRIRCache::evictSlot()
+    {
+        while (true)
+        {
+            auto slotIndex = clockHand;
+            auto &slot = *slots[slotIndex];
+            clockHand = (clockHand + 1) % slots.size();
+            
+            if (!slot.occupied)
+                return slotIndex;
+            
+            if (!slot.referenced.exchange(false, std::memory_order_relaxed))
+            {
+                index.erase(slot.key);
+                slot.occupied = false;
+                evictions.fetch_add(1, std::memory_order_relaxed);
+                
+                return slotIndex;
+            }
+        }
+    }
+}
@@ -0,0 +1,136 @@
+//
+//  SOFAHRIRCache.hpp
+//  BasicSOFA
+//
+//  Copyright © 2020 meoWorkshop. All rights reserved.
+//
+
+#ifndef SOFAHRIRCache_
+#define SOFAHRIRCache_
+
+#include "BasicSOFA.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace BasicSOFA
+{
+
+    //  How a cached IR is produced from the loaded data
+    enum class SOFAQueryMode
+    {
+        Measured,       //  IR of the measured direction, as returned by BasicSOFA::copyHRIR()
+        DistanceModel   //  IR rendered for any distance, as returned by BasicSOFA::getDistanceModelledHRIR()
+    };
+
+
+    struct SOFACacheStatistics
+    {
+        uint64_t        hits;
+        uint64_t        misses;
+        uint64_t        evictions;
+        
+        double          getHitRate () const { return (hits + misses) > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0; }
+    };
+
+
+    /*
+     *  Bounded cache of IRs keyed on the quantised (channel, theta, phi, radius) and query mode
+     *
+     *  Queries are rounded to angleResolution degrees and radiusResolution metres, and every query falling in the same cell shares an entry
+     *  Slots are recycled with the CLOCK algorithm
+     *
+     *  Each thread keeps a small front-end table of the slots it has recently hit
+     *  A hit in that table copies the IR out of its slot without taking a lock, using a per-slot sequence counter to detect a concurrent eviction
+     *  Anything else falls through to the shared index, which is guarded by a mutex
+     */
+    class SOFAHRIRCache
+    {
+    public:
+    
+                        SOFAHRIRCache (const BasicSOFA &sofa, size_t capacity, double angleResolution = 0.1, double radiusResolution = 0.01);
+        
+        bool            getHRIR (size_t channel, double theta, double phi, double radius, double *dest, SOFAQueryMode mode = SOFAQueryMode::Measured);
+        
+        void            clear ();
+        SOFACacheStatistics getStatistics () const;
+        void            resetStatistics ();
+        
+        size_t          getCapacity () const { return slots.size(); }
+
+
+
+    protected:
+    
+        struct CacheKey
+        {
+            int64_t     theta;
+            int64_t     phi;
+            int64_t     radius;
+            uint32_t    channel;
+            uint32_t    mode;
+            
+            bool        operator== (const CacheKey &other) const
+            {
+                return theta == other.theta && phi == other.phi && radius == other.radius && channel == other.channel && mode == other.mode;
+            }
+        };
+        
+        struct CacheKeyHash
+        {
+            size_t      operator() (const CacheKey &key) const;
+        };
+        
+        struct CacheSlot
+        {
+            CacheKey                key;
+            bool                    occupied;
+            std::atomic<uint64_t>   sequence;       //  Odd while the slot is being rewritten
+            std::atomic<bool>       referenced;     //  CLOCK reference bit
+            std::vector<double>     hrir;
+        };
+        
+        struct FrontEndEntry
+        {
+            CacheKey    key;
+            size_t      slot;
+            uint64_t    sequence;
+            bool        valid;
+        };
+        
+        struct FrontEnd
+        {
+            uint64_t        cacheId;
+            FrontEndEntry   entries[64];
+        };
+        
+        CacheKey                quantise (size_t channel, double theta, double phi, double radius, SOFAQueryMode mode) const;
+        bool                    evaluate (const CacheKey &key, double *dest) const;
+        FrontEnd&               getFrontEnd () const;
+        size_t                  evictSlot ();
+        void                    resetSlots (size_t length);
+
+
+        const BasicSOFA                                     &sofa;
+        uint64_t                                            cacheId;
+        double                                              angleResolution;
+        double                                              radiusResolution;
+        
+        std::vector<std::unique_ptr<CacheSlot>>             slots;
+        std::atomic<size_t>                                 slotLength;     //  Number of samples each slot holds
+        std::unordered_map<CacheKey, size_t, CacheKeyHash>  index;
+        size_t                                              clockHand;
+        std::mutex                                          indexMutex;
+        
+        std::atomic<uint64_t>                               hits;
+        std::atomic<uint64_t>                               misses;
+        std::atomic<uint64_t>                               evictions;
+    };
+}
+
+#pragma GCC visibility pop
+#endif
@@ -0,0 +1,226 @@
+//
+//  SOFAPrefetcher.cpp
+//  BasicSOFA
+//
+//  Copyright © 2020 meoWorkshop. All rights reserved.
+//
+
+#include "SOFAPrefetcher.hpp"
+
+namespace BasicSOFA
+{
+    SOFAPrefetcher::SOFAPrefetcher(const BasicSOFA &sofa, size_t numSources, size_t lookahead) : sofa(sofa)
+    {
+        this->lookahead = lookahead > 0 ? lookahead : 1;
+        running = false;
+        
+        for (size_t i = 0; i < numSources; ++i)
+        {
+            auto source = std::unique_ptr<SourceState>(new SourceState);
+            
+            source->queue = std::vector<SOFAPrefetchedHRIR>(this->lookahead);
+            for (auto &entry : source->queue)
+            {
+                entry.valid = false;
+                entry.N = sofa.getN();
+                entry.hrir = std::vector<double>(sofa.getR() * sofa.getN());
+            }
+            
+            source->head = 0;
+            source->tail = 0;
+            source->generation = 0;
+            source->currentBlock = 0;
+            source->trajectoryGeneration = 0;
+            source->nextPoint = 0;
+            source->workerGeneration = 0;
+            
+            sources.push_back(std::move(source));
+        }
+    }
+    
+    
+    SOFAPrefetcher::~SOFAPrefetcher()
+    {
+        stop();
+    }
+    
+    
+    /*
+     *  Start the worker.  Fails if the BasicSOFA object has no data loaded
+     *  The queue entries are sized here for the loaded data, so the prefetcher can be built before the object is loaded
+     *  or reused after a reload with a different N or R, as long as it is stopped while the object is reloaded
+     */
+    bool SOFAPrefetcher::start()
+    {
+        size_t N = sofa.getN();
+        size_t R = sofa.getR();
+        
+        if (running || N == 0 || R == 0)
+            return false;
+        
+        for (auto &source : sources)
+        {
+            for (auto &entry : source->queue)
+            {
+                if (entry.N == N && entry.hrir.size() == R * N)
+                    continue;
+                
+                entry.valid = false;
+                entry.N = N;
+                entry.hrir = std::vector<double>(R * N);
+            }
+        }
+        
+        running = true;
+        worker = std::thread(&SOFAPrefetcher::workerLoop, this);
+        
+        return true;
+    }
+    
+    
+    void SOFAPrefetcher::stop()
+    {
+        if (!running)
+            return;
+        
+        {
+            std::lock_guard<std::mutex> lock(trajectoryMutex);
+            running = false;
+        }
+        
+        trajectoryChanged.notify_one();
+        worker.join();
+    }
+    
+    
+    /*
+     *  Replace the predicted trajectory of a source
+     *  Points should be in increasing block order
+     *  Entries already queued for the old trajectory are dropped by the audio thread on its next query
+     */
+    bool SOFAPrefetcher::setTrajectory(size_t source, const std::vector<SOFATrajectoryPoint> &trajectory)
+    {
+        if (source >= sources.size())
+            return false;
+        
+        {
+            std::lock_guard<std::mutex> lock(trajectoryMutex);
+            auto &state = *sources[source];
+            
+            state.trajectory = trajectory;
+            state.trajectoryGeneration++;
+            state.generation.store(state.trajectoryGeneration, std::memory_order_release);
+        }
+        
+        trajectoryChanged.notify_one();
+        
+        return true;
+    }
+    
+    
+    void SOFAPrefetcher::clearTrajectory(size_t source)
+    {
+        setTrajectory(source, std::vector<SOFATrajectoryPoint>());
+    }
+    
+    
+    /*
+     *  Called from the audio thread
+     *  Entries for blocks before the given block or for an outdated trajectory are released back to the worker
+     *  Returns nullptr if the IR for this block has not been prefetched, in which case the caller should fall back to BasicSOFA
+     *  The returned entry stays valid until this is called again for the same source with a later block
+     */
+    const SOFAPrefetchedHRIR* SOFAPrefetcher::getPrefetchedHRIR(size_t source, uint64_t block) noexcept
+    {
+        if (source >= sources.size())
+            return nullptr;
+        
+        auto &state = *sources[source];
+        state.currentBlock.store(block, std::memory_order_relaxed);
+        
+        auto generation = state.generation.load(std::memory_order_acquire);
+        auto tail = state.tail.load(std::memory_order_relaxed);
+        auto head = state.head.load(std::memory_order_acquire);
+        
+        while (tail != head)
+        {
+            const auto &entry = state.queue[tail % lookahead];
+            if (entry.generation == generation && entry.block >= block)
+                break;
+            
+            ++tail;
+        }
+        
+        state.tail.store(tail, std::memory_order_release);
+        
+        if (tail == head)
+            return nullptr;
+        
+        const auto &entry = state.queue[tail % lookahead];
+        return entry.block == block ? &entry : nullptr;
+    }
+    
+    
+    void SOFAPrefetcher::workerLoop()
+    {
+        while (running)
+        {
+            for (auto &source : sources)
+                fillQueue(*source);
+            
+            std::unique_lock<std::mutex> lock(trajectoryMutex);
+            trajectoryChanged.wait_for(lock, std::chrono::milliseconds(pollIntervalMs));
+        }
+    }
+    
+    
+    /*
+     *  Resolve trajectory points into the queue of a source until the queue is full or the trajectory runs out
+     *  Points for blocks the audio thread has already passed are skipped
+     */
+    void SOFAPrefetcher::fillQueue(SourceState &source)
+    {
+        {
+            std::lock_guard<std::mutex> lock(trajectoryMutex);
+            if (source.workerGeneration != source.trajectoryGeneration)
+            {
+                source.pending = source.trajectory;
+                source.nextPoint = 0;
+                source.workerGeneration = source.trajectoryGeneration;
+            }
+        }
+        
+        auto currentBlock = source.currentBlock.load(std::memory_order_relaxed);
+        
+        while (source.nextPoint < source.pending.size())
+        {
+            auto head = source.head.load(std::memory_order_relaxed);
+            if (head - source.tail.load(std::memory_order_acquire) >= lookahead)
+                return;
+            
+            const auto &point = source.pending[source.nextPoint++];
+            if (point.block < currentBlock)
+                continue;
+            
+            auto &entry = source.queue[head % lookahead];
+            entry.block = point.block;
+            entry.generation = source.workerGeneration;
+            entry.theta = point.theta;
+            entry.phi = point.phi;
+            entry.radius = point.radius;
+            entry.valid = true;
+            
+            //  Never write past the entry if the object was reloaded with different dimensions while running
+            if (entry.N != sofa.getN() || entry.hrir.size() != entry.N * sofa.getR())
+                entry.valid = false;
+            
+            for (size_t channel = 0; entry.valid && channel < sofa.getR(); ++channel)
+            {
+                if (!sofa.copyHRIR(channel, point.theta, point.phi, point.radius, entry.hrir.data() + (channel * entry.N)))
+                    entry.valid = false;
+            }
+            
+            source.head.store(head + 1, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+//
+//  SOFAPrefetcher.hpp
+//  BasicSOFA
+//
+//  Copyright © 2020 meoWorkshop. All rights reserved.
+//
+
+#ifndef SOFAPrefetcher_
+#define SOFAPrefetcher_
+
+#include "BasicSOFA.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace BasicSOFA
+{
+
+    struct SOFATrajectoryPoint
+    {
+        uint64_t    block;      //  Audio block the direction is predicted for
+        double      theta;
+        double      phi;
+        double      radius;
+    };
+
+
+    struct SOFAPrefetchedHRIR
+    {
+        uint64_t                block;
+        uint64_t                generation;
+        double                  theta;
+        double                  phi;
+        double                  radius;
+        bool                    valid;      //  false if the direction could not be found in the loaded data
+        size_t                  N;
+        std::vector<double>     hrir;       //  [R x N], each receiver's IR is contiguous
+        
+        const double*   getHRIR (size_t channel) const noexcept { return valid ? hrir.data() + (channel * N) : nullptr; }
+    };
+
+
+    /*
+     *  Resolves the HRIRs along predicted source trajectories ahead of time
+     *
+     *  A control thread registers a trajectory (a list of directions, each tagged with the audio block it is predicted for) per source
+     *  A background worker walks each trajectory, resolves the next lookahead directions and copies their IRs into
+     *  a bounded single producer, single consumer queue per source
+     *  The audio thread picks up the entry for the current block with getPrefetchedHRIR(), which never locks or allocates
+     *
+     *  The BasicSOFA object must outlive the prefetcher, and must stay loaded while the prefetcher is running
+     */
+    class SOFAPrefetcher
+    {
+    public:
+    
+                        SOFAPrefetcher (const BasicSOFA &sofa, size_t numSources, size_t lookahead);
+                        ~SOFAPrefetcher ();
+        
+        bool            start ();
+        void            stop ();
+        
+        bool            setTrajectory (size_t source, const std::vector<SOFATrajectoryPoint> &trajectory);
+        void            clearTrajectory (size_t source);
+        
+        const SOFAPrefetchedHRIR*   getPrefetchedHRIR (size_t source, uint64_t block) noexcept;
+        
+        size_t          getNumSources () const { return sources.size(); }
+        size_t          getLookahead () const { return lookahead; }
+
+
+
+    protected:
+    
+        struct SourceState
+        {
+            //  Handoff queue shared by the worker (producer) and the audio thread (consumer)
+            //  head and tail only ever increase, the slot in use is the counter modulo the queue size
+            std::vector<SOFAPrefetchedHRIR>     queue;
+            std::atomic<size_t>                 head;
+            std::atomic<size_t>                 tail;
+            std::atomic<uint64_t>               generation;
+            std::atomic<uint64_t>               currentBlock;
+            
+            //  Guarded by trajectoryMutex
+            std::vector<SOFATrajectoryPoint>    trajectory;
+            uint64_t                            trajectoryGeneration;
+            
+            //  Only touched by the worker
+            std::vector<SOFATrajectoryPoint>    pending;
+            size_t                              nextPoint;
+            uint64_t                            workerGeneration;
+        };
+        
+        void                    workerLoop ();
+        void                    fillQueue (SourceState &source);
+
+
+        const BasicSOFA                             &sofa;
+        std::vector<std::unique_ptr<SourceState>>   sources;
+        size_t                                      lookahead;
+        
+        std::thread                                 worker;
+        std::atomic<bool>                           running;
+        std::mutex                                  trajectoryMutex;
+        std::condition_variable                     trajectoryChanged;
+        
+        static constexpr int                        pollIntervalMs = 1;     //  How often the worker checks for room in the queues
+    };
+}
+
+#pragma GCC visibility pop
+#endif